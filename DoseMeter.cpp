@@ -0,0 +1,175 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "DoseMeter.h"
+
+DoseMeter::DoseMeter(LightSensor &s)
+    : sensor(s)
+{
+    valid=false;
+    highgain=true;
+    refhard=refsoft=0;
+    active=false;
+    ratio=1024;
+}
+
+void DoseMeter::load()
+{
+    int addr=EE_DOSEREF;
+    valid=false;
+    if(EEPROM.read(addr++) != MAGIC)
+        return;
+    highgain=EEPROM.read(addr++) != 0;
+    refhard=EEPROM.read(addr++) << 8;
+    refhard|=EEPROM.read(addr++);
+    refsoft=EEPROM.read(addr++) << 8;
+    refsoft|=EEPROM.read(addr++);
+    valid=true;
+}
+
+void DoseMeter::save()
+{
+    int addr=EE_DOSEREF;
+    EEPROM.write(addr++, MAGIC);
+    EEPROM.write(addr++, highgain ? 1 : 0);
+    EEPROM.write(addr++, (refhard >> 8) & 0xFF);
+    EEPROM.write(addr++, refhard & 0xFF);
+    EEPROM.write(addr++, (refsoft >> 8) & 0xFF);
+    EEPROM.write(addr++, refsoft & 0xFF);
+    valid=true;
+}
+
+void DoseMeter::enable()
+{
+    sensor.start(highgain ? TSL2561_GAIN_16X : TSL2561_GAIN_0X,
+                 TSL2561_INTEGRATIONTIME_13MS, true);
+}
+
+unsigned int DoseMeter::measure()
+{
+    unsigned long sum=0;
+    for(unsigned char i=0;i<SETTLEWINDOWS+REFWINDOWS;++i){
+        while(!sensor.poll())
+            ;
+        if(i >= SETTLEWINDOWS)
+            sum+=sensor.getFull();
+    }
+    return sum/REFWINDOWS;
+}
+
+bool DoseMeter::calibrate(LEDDriver &led)
+{
+    const unsigned int hardfull=LEDDriver::toFine(LEDDriver::LED_HARD_MAX);
+    const unsigned int softfull=LEDDriver::toFine(LEDDriver::LED_SOFT_MAX);
+    const unsigned int off=LEDDriver::FINE_OFF;
+
+    unsigned int hard=0, soft=0;
+    highgain=true;
+    for(;;){
+        enable();
+        led.exposeOn(hardfull, off, hardfull, off);
+        hard=measure();
+        led.exposeOn(off, softfull, off, softfull);
+        soft=measure();
+        led.allOff();
+
+        // too bright for 16x: go again at 1x
+        if(highgain && max(hard, soft) > SATURATED)
+            highgain=false;
+        else
+            break;
+    }
+    stop();
+
+    if(hard < MINCOUNTS || soft < MINCOUNTS || max(hard, soft) > SATURATED)
+        return false;
+    refhard=hard;
+    refsoft=soft;
+    save();
+    return true;
+}
+
+bool DoseMeter::start(unsigned long us, unsigned int hard, unsigned int soft)
+{
+    active=false;
+    if(!valid)
+        return false;
+
+    unsigned long p=(unsigned long)refhard*LEDDriver::relativeOutput(true, hard)
+                   +(unsigned long)refsoft*LEDDriver::relativeOutput(false, soft);
+    predicted=p >> 10;
+    if(predicted < MINCOUNTS)
+        return false;
+
+    enable();
+    ratio=1024;
+    target=us;
+    dose=0;
+    lastontime=0;
+    settleat=SETTLEUS;
+    lastcount=sensor.getCount();
+    active=true;
+    return true;
+}
+
+void DoseMeter::resume(unsigned long ontimeus)
+{
+    if(!active)
+        return;
+    // what went before the pause was at the last rate
+    dose+=((ontimeus-lastontime) >> 2)*ratio >> 8;
+    lastontime=ontimeus;
+    settleat=ontimeus+SETTLEUS;
+}
+
+bool DoseMeter::poll(unsigned long ontimeus)
+{
+    if(!active)
+        return false;
+    sensor.poll();
+    if(sensor.getCount() == lastcount)
+        return false;
+    lastcount=sensor.getCount();
+    if(ontimeus < settleat)
+        return false;
+
+    unsigned long r=((unsigned long)sensor.getFull() << 10)/predicted;
+    if(r >= RATIO_MIN && r <= RATIO_MAX)
+        ratio=r;
+
+    // on-time since the last reading counts at the rate just read;
+    // quarter-us keeps 1s of on-time times RATIO_MAX within 32 bits
+    dose+=((ontimeus-lastontime) >> 2)*ratio >> 8;
+    lastontime=ontimeus;
+    return true;
+}
+
+unsigned long DoseMeter::getRemaining() const
+{
+    if(dose >= target)
+        return 0;
+    // owed dose at the current rate, without overflowing
+    unsigned long owed=target-dose;
+    return (owed/ratio)*1024+((owed%ratio)*1024)/ratio;
+}
+
+void DoseMeter::stop()
+{
+    active=false;
+    sensor.stop();
+}
@@ -0,0 +1,136 @@
+/* -*- C++ -*- */
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _DOSE_METER_H_
+#define _DOSE_METER_H_
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "EEPROMLayout.h"
+#include "LightSensor.h"
+#include "LEDDriver.h"
+
+/**
+ * Closed-loop exposure by integrating the light the TSL2561 sees.
+ *
+ * A reference exposure at full power records the sensor's rate for
+ * each LED type (calibrate()).  While exposing, the sensor runs with
+ * its shortest integration window, collected by the LightSensor task,
+ * and each reading is compared with the rate the references predict
+ * for the exposure's powers.  LED-on time weighted by that ratio is
+ * the dose delivered so far, in microseconds at the predicted rate;
+ * what is still owed, at the latest rate, is handed back to the
+ * Executor so that ExposureTimer still ends the exposure from its ISR.
+ * Sensor reads happen only in the foreground, so they cost loop time
+ * but never shutoff accuracy.
+ *
+ * Until the first good reading, and for any reading too far from the
+ * prediction to be believed, the predicted rate is assumed, which is
+ * plain timed exposure.  Exposures shorter than a couple of windows
+ * are therefore effectively open-loop.
+ */
+class DoseMeter {
+public:
+
+    DoseMeter(LightSensor &s);
+
+    /// read references from EEPROM; invalid if never calibrated
+    void load();
+
+    /// both references measured
+    bool isValid() const {
+        return valid;
+    }
+
+    /// measure and save both references, switching the LEDs itself
+    /// @return false if either LED type is too dim to meter
+    bool calibrate(LEDDriver &led);
+
+    /// begin metering an exposure; powers the sensor up
+    /// @param us compiled duration at the predicted rate
+    /// @param hard fine power of the hard channels
+    /// @param soft fine power of the soft channels
+    /// @return false if the light is too dim to meter (nothing started)
+    bool start(unsigned long us, unsigned int hard, unsigned int soft);
+
+    /// LEDs back on after a pause; readings spanning the gap are dropped
+    /// @param ontimeus ExposureTimer::getOnTime() at resume
+    void resume(unsigned long ontimeus);
+
+    /// take in a new reading if there is one and update the dose
+    /// @param ontimeus ExposureTimer::getOnTime() now
+    /// @return true if getRemaining() has changed
+    bool poll(unsigned long ontimeus);
+
+    /// LED-on time still needed at the latest rate, us (0 if done)
+    unsigned long getRemaining() const;
+
+    /// latest measured rate over predicted, in 1/1024ths
+    unsigned int getRatio() const {
+        return ratio;
+    }
+
+    /// metering an exposure
+    bool isActive() const {
+        return active;
+    }
+
+    /// finish metering and power the sensor down
+    void stop();
+
+private:
+
+    /// nominal TSL2561_INTEGRATIONTIME_13MS window
+    static const unsigned long WINDOWUS=13700;
+    /// windows before readings are trusted: the one in progress at a
+    /// switch-on straddles it
+    static const unsigned char SETTLEWINDOWS=2;
+    static const unsigned long SETTLEUS=SETTLEWINDOWS*WINDOWUS;
+    /// windows averaged for a reference
+    static const unsigned char REFWINDOWS=16;
+    /// below this many counts per window the light is too dim to meter
+    static const unsigned int MINCOUNTS=40;
+    /// the 13.7ms window clips at 5047; references above this at 16x
+    /// gain are taken again at 1x
+    static const unsigned int SATURATED=4000;
+    /// readings outside half to twice the prediction are ignored
+    static const unsigned int RATIO_MIN=512, RATIO_MAX=2048;
+    static const unsigned char MAGIC=0xD5;
+
+    /// short windows at the stored gain, continuously
+    void enable();
+    /// mean of REFWINDOWS windows with the LEDs steady
+    unsigned int measure();
+    void save();
+
+    LightSensor &sensor;
+
+    bool valid;
+    bool highgain;
+    unsigned int refhard, refsoft;   ///< counts per window at full power
+
+    bool active;
+    unsigned int predicted;          ///< counts per window expected
+    unsigned int ratio;
+    unsigned long target, dose;      ///< us at the predicted rate
+    unsigned long lastontime, settleat;
+    unsigned char lastcount;         ///< LightSensor::getCount() last taken in
+};
+
+#endif // _DOSE_METER_H_
@@ -29,8 +29,24 @@
 #define EE_STRIPCOV 0x08
 #define EE_VERSION 0x09
 #define EE_SPLITGRADE 0x0A
-#define EE_CONFIGTOP 0x0B
 #define EE_STRIPGRADE 0x0C
-#define EE_TOP 0x400
+#define EE_STRIPROWS 0x0D
+#define EE_STRIPGSTEP 0x0E
+#define EE_STRIPSTAG 0x0F
+#define EE_INTEGRATE 0x10
+#define EE_POWERFIT 0x11
+#define EE_CONFIGTOP 0x12     // settings all lie below here
+
+// program slots start every 128 bytes from 0x80 but hold 168 bytes, so
+// the last ends at 0x427 (see Program::slotAddr)
+#define EE_SLOTTOP 0x428
+
+// Mega 2560 only: beyond the original 1K part
+#define EE_LAMPCOMP 0x430     // LampModel: magic + 4x9 offsets, 73 bytes
+#define EE_PAPERCACHE 0x480   // PaperCache: 3x (file, rank, Paper::Image), 288 bytes
+#define EE_LINEAR 0x5A0       // LEDDriver: 2x (magic, 255 16-bit PWM values), 1022 bytes
+#define EE_DOSEREF 0x9A0      // DoseMeter: magic, gain, 2x reference counts, 6 bytes
+#define EE_BALANCE 0x9B0      // ZoneBalance: magic, 2x2 gains, 9 bytes
+#define EE_TOP 0x1000
 
 #endif
\ No newline at end of file
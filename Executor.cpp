@@ -18,8 +18,8 @@
 
 #include "Executor.h"
 
-Executor::Executor(LiquidCrystal &l, Keypad &k, ButtonDebounce &b, ButtonDebounce &fs, LEDDriver &led)
-    : disp(l), keys(k), button(b), footswitch(fs), leddriver(led)
+Executor::Executor(LiquidCrystal &l, Keypad &k, ButtonDebounce &b, ButtonDebounce &fs, LEDDriver &led, ExposureStats &st, const LampModel &lm, DoseMeter &dm)
+    : disp(l), keys(k), button(b), footswitch(fs), leddriver(led), engine(led), stats(st), lamp(lm), meter(dm)
 {
     current=NULL;
 }
@@ -28,6 +28,9 @@ void Executor::begin()
 {
     execphase=0;
     dd=false;
+    integ=false;
+    state=EX_IDLE;
+    engine.begin();
 }
 
 void Executor::setProgram(Program *p)
@@ -48,6 +51,12 @@ void Executor::setSplitgrade(bool s)
     changePhase(0);
 }
 
+void Executor::setIntegrating(bool i)
+{
+    integ=i;
+    changePhase(0);
+}
+
 /// specify that program is up to a particular exposure; display it
 void Executor::changePhase(unsigned char ph)
 {
@@ -57,6 +66,8 @@ void Executor::changePhase(unsigned char ph)
 	execphase = ph;
 
     (*current).getExposure(execphase).display(disp, dispbuf, true);
+    disp.setCursor(17, 2);
+    disp.print(integ ? "I" : " ");
     disp.setCursor(18, 2);
     disp.print(sg ? "S" : " ");
     disp.setCursor(19, 2);
@@ -65,116 +76,164 @@ void Executor::changePhase(unsigned char ph)
 
 void Executor::expose()
 {
-    if(NULL == current)
+    if(NULL == current || state != EX_IDLE)
         return;
 
     // backup the duration; it will get overwritten for display purposes
     Program::Exposure &expo=(*current).getExposure(execphase);
-    unsigned long msbackup=expo.ms;
-    unsigned long start=micros();
-    unsigned long now=start, dt=0, lastupdate=start;
-
-    // begin
-    leddriver.exposeOn(expo.hardpower, expo.softpower, expo.hardpower, expo.softpower);
-
-    // polling loop
-    bool cancelled=false, skipped=false;
-    while(!skipped){
-        now=micros();
-        dt=(now-start)/1000;    // works with overflows
-
-        // time is elapsed
-        if(dt >= msbackup){
-            break;
+    usbackup=expo.us;
+    lastupdate=lastloop=micros();
+    worstloop=0;
+
+    // sensor first, so its first window is under way as the LEDs come on;
+    // its rate predictions assume both zones on throughout
+    if(integ && expo.cornerus == expo.us)
+        meter.start(usbackup, expo.hardpower, expo.softpower);
+
+    // begin; the engine's ISR will end it
+    state=EX_ON;
+    engine.start(usbackup, expo.cornerus, expo.hardpower, expo.softpower, expo.hardcorner, expo.softcorner,
+                 lamp.getZoneOffset(false, expo.hardpower, expo.softpower),
+                 lamp.getZoneOffset(true, expo.hardcorner, expo.softcorner));
+}
+
+bool Executor::poll()
+{
+    switch(state){
+    case EX_ON:
+        pollOn();
+        break;
+    case EX_PAUSED:
+        pollPaused();
+        break;
+    case EX_SKIPPED:
+        finishExposure();
+        break;
+    case EX_CANCELLED:
+    case EX_FINISHED:
+        // swallow input while the notice is up
+        if(keys.available())
+            keys.readRaw();
+        button.hadPress();
+        footswitch.hadPress();
+        if(micros()-noticeat > NOTICE_US){
+            state=EX_IDLE;
+            changePhase(0);
         }
+        break;
+    }
 
-        // time for some IO?  otherwise tighten the loop a bit
-        if((msbackup-dt) > 50){
-            if((now-lastupdate) > 100000){
-                // re-display with reduced time remaining
-                expo.ms=msbackup-dt;
-                expo.displayTime(disp, dispbuf, true);
-                lastupdate=now;
-            }
-
-            // pause!
-            keys.scan();
-            button.scan();
-            footswitch.scan();
-            
-            bool buttonPressed = button.hadPress() || footswitch.hadPress();
-            if(keys.available() || buttonPressed){
-                if (keys.readRaw() == Keypad::KP_HASH || buttonPressed){
-                    leddriver.allOff();
-                    unsigned long pausestart=micros();
-
-                    // cancel on anything but Expose buttons
-                    buttonPressed = false;
-                    do {
-                        keys.scan();
-                        button.scan();
-                        footswitch.scan();
-                        buttonPressed = button.hadPress() || footswitch.hadPress();
-                    } while(!keys.available() && !buttonPressed);
-
-                    if (buttonPressed){
-                        start+=micros()-pausestart;
-					    leddriver.exposeOn(expo.hardpower, expo.softpower, expo.hardpower, expo.softpower);
-                    } else {
-                        char ch = keys.readRaw();                    
-                        switch(ch){
-                            case Keypad::KP_HASH:
-                            // adjust clock and resume exposing
-                            // !! should account for enlarger warmup here
-                            start+=micros()-pausestart;
-					        leddriver.exposeOn(expo.hardpower, expo.softpower, expo.hardpower, expo.softpower);
-                            break;
-                            case Keypad::KP_B:
-                            // halt and this exposure
-                            skipped=true;
-                            break;
-                            default:
-                            // halt and cancel
-                            skipped=true;
-                            cancelled=true;
-                        }
-                    }
-                    
-                }
-            }
+    return state != EX_IDLE;
+}
+
+void Executor::pollOn()
+{
+    unsigned long now=micros();
+    if(now-lastloop > worstloop)
+        worstloop=now-lastloop;
+    lastloop=now;
+
+    if(engine.isDone()){
+        // a metered exposure runs long or short on purpose; the LEDs
+        // are on until the longer of the two zones finishes
+        if(!meter.isActive())
+            stats.record(max(usbackup, (*current).getExposure(execphase).cornerus),
+                         engine.getOnTime(), worstloop);
+        finishExposure();
+        return;
+    }
+
+    if(meter.poll(engine.getOnTime()))
+        engine.setRemaining(meter.getRemaining());
+
+    if((now-lastupdate) > 100000){
+        // re-display with reduced time remaining
+        Program::Exposure &expo=(*current).getExposure(execphase);
+        expo.us=engine.getRemaining();
+        expo.displayTime(disp, dispbuf, true);
+        lastupdate=now;
+    }
+
+    // pause!
+    bool buttonPressed = button.hadPress() || footswitch.hadPress();
+    if(keys.available() || buttonPressed){
+        if (keys.readRaw() == Keypad::KP_HASH || buttonPressed){
+            engine.pause();
+            // may have expired just before we got there
+            if(!engine.isDone())
+                state=EX_PAUSED;
         }
     }
+}
+
+void Executor::pollPaused()
+{
+    // resume on Expose buttons
+    if(button.hadPress() || footswitch.hadPress()){
+        meter.resume(engine.getOnTime());
+        engine.resume();
+        lastloop=micros();  // waiting for the user isn't loop latency
+        state=EX_ON;
+        return;
+    }
+
+    if(!keys.available())
+        return;
+
+    switch(keys.readRaw()){
+    case Keypad::KP_HASH:
+        // resume exposing where we left off
+        meter.resume(engine.getOnTime());
+        engine.resume();
+        lastloop=micros();
+        state=EX_ON;
+        break;
+    case Keypad::KP_B:
+        // halt and skip this exposure
+        state=EX_SKIPPED;
+        break;
+    default:
+        // halt and cancel
+        engine.stop();
+        if(meter.isActive())
+            meter.stop();
+        (*current).getExposure(execphase).us=usbackup;
+        notice("Prog Cancelled", EX_CANCELLED);
+    }
+}
 
+void Executor::finishExposure()
+{
     // cease
-	leddriver.allOff();
+    engine.stop();
+    if(meter.isActive())
+        meter.stop();
 
     // restore
-    expo.ms=msbackup;
-
-    if(cancelled){
-        // tell user to go home
-        disp.clear();
-        disp.print("Prog Cancelled");
-        delay(1000);
-        changePhase(0);
-    }
-    else{
-        nextPhase();
-    }
+    (*current).getExposure(execphase).us=usbackup;
+
+    state=EX_IDLE;
+    nextPhase();
+}
+
+void Executor::notice(const char *msg, unsigned char st)
+{
+    disp.clear();
+    disp.print(msg);
+    noticeat=micros();
+    state=st;
 }
 
 void Executor::nextPhase()
 {
     // decide on next exposure or reset to beginning
     for(int newphase=execphase+1; newphase < Program::MAXEXPOSURES;++newphase){
-        if((*current).getExposure(newphase).ms != 0){
+        const Program::Exposure &e=(*current).getExposure(newphase);
+        if(e.us != 0 || e.cornerus != 0){
             changePhase(newphase);
             return;
         }
     }
 
-    disp.clear();
-    disp.print("Program Complete");
-    delay(1000);
-    changePhase(0);
+    notice("Program Complete", EX_FINISHED);
 }
@@ -23,11 +23,32 @@
 #include <LiquidCrystal.h>
 #include "Keypad.h"
 #include "LEDDriver.h"
+#include "ExposureTimer.h"
+#include "ExposureStats.h"
+#include "LampModel.h"
+#include "DoseMeter.h"
 #include "Program.h"
 
+/**
+ * Runs a compiled Program one exposure at a time.  An exposure is a
+ * small state machine advanced by poll() from the main loop, so the
+ * rest of the firmware keeps running while the LEDs are on; the LED
+ * switching itself is timed by the ExposureTimer ISR.
+ */
 class Executor {
 public:
-  Executor(LiquidCrystal &d, Keypad &k, ButtonDebounce &b, ButtonDebounce &fs, LEDDriver &led);
+
+  /// exposure states
+  enum {
+    EX_IDLE,        ///< waiting at a phase for the user to expose
+    EX_ON,          ///< LEDs on, engine counting down
+    EX_PAUSED,      ///< LEDs off, waiting for resume/skip/cancel
+    EX_SKIPPED,     ///< remainder of exposure abandoned
+    EX_CANCELLED,   ///< program abandoned; notice showing
+    EX_FINISHED     ///< program complete; notice showing
+  };
+
+  Executor(LiquidCrystal &d, Keypad &k, ButtonDebounce &b, ButtonDebounce &fs, LEDDriver &led, ExposureStats &st, const LampModel &lm, DoseMeter &dm);
 
   void begin();
 
@@ -43,6 +64,10 @@ public:
   /// @param s whether to indicate that splitgrade is applied
   void setSplitgrade(bool s);
 
+  /// set closed-loop exposure
+  /// @param i whether to end exposures on the dose the sensor measures
+  void setIntegrating(bool i);
+
   Program *getProgram() const { 
     return current; 
   }
@@ -57,11 +82,35 @@ public:
   /// move onto next phase
   void nextPhase();
 
-  /// do a controlled exposure
+  /// begin a controlled exposure of the current phase; returns at once
   void expose();
 
+  /// advance the exposure state machine; call every loop.
+  /// @return true if busy, in which case keypad/button input is ours
+  bool poll();
+
+  bool isBusy() const {
+    return state != EX_IDLE;
+  }
+
+  unsigned char getState() const {
+    return state;
+  }
+
 private:    
 
+  /// how long end-of-program notices stay up
+  static const unsigned long NOTICE_US=1000000;
+
+  void pollOn();
+  void pollPaused();
+
+  /// exposure has ended by completion or skip; restore and move on
+  void finishExposure();
+
+  /// show a notice and return to phase 0 when it times out
+  void notice(const char *msg, unsigned char st);
+
   /// program we're working on
   Program *current;
 
@@ -70,13 +119,23 @@ private:
   ButtonDebounce &button;
   ButtonDebounce &footswitch;
   LEDDriver &leddriver;
+  ExposureTimer engine;
+  ExposureStats &stats;
+  const LampModel &lamp;
+  DoseMeter &meter;
   char dispbuf[21];
 
   bool dd;
   bool sg;
+  bool integ;
 
   /// program phase about to be executed
   unsigned char execphase;
+
+  unsigned char state;
+  /// compiled duration of the running exposure; expo.us counts down for display
+  unsigned long usbackup;
+  unsigned long lastupdate, lastloop, worstloop, noticeat;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "ExposureStats.h"
+
+ExposureStats::ExposureStats()
+{
+    clear();
+}
+
+void ExposureStats::clear()
+{
+    head=0;
+    count=0;
+}
+
+void ExposureStats::record(unsigned long commandedus, unsigned long measuredus, unsigned long worstloopus)
+{
+    Record &r=records[head];
+    r.commanded=commandedus;
+    r.error=(long)(measuredus-commandedus);
+    r.worstloop=worstloopus > 0xFFFF ? 0xFFFF : worstloopus;
+
+    head=(head+1) % DEPTH;
+    if(count < DEPTH)
+        ++count;
+}
+
+const ExposureStats::Record &ExposureStats::getRecord(unsigned char which) const
+{
+    return records[(head+DEPTH-1-which) % DEPTH];
+}
+
+void ExposureStats::summarise(Summary &s) const
+{
+    s.count=count;
+    s.minerror=s.maxerror=s.meanerror=0;
+    s.worstloop=0;
+    for(unsigned char b=0;b<BINS;++b)
+        s.bins[b]=0;
+
+    if(0 == count)
+        return;
+
+    long sum=0;
+    s.minerror=s.maxerror=getRecord(0).error;
+    for(unsigned char i=0;i<count;++i){
+        const Record &r=getRecord(i);
+        sum+=r.error;
+        if(r.error < s.minerror)
+            s.minerror=r.error;
+        if(r.error > s.maxerror)
+            s.maxerror=r.error;
+        if(r.worstloop > s.worstloop)
+            s.worstloop=r.worstloop;
+
+        long bin=(r.error-BINBASE)/BINWIDTH;
+        if(r.error < BINBASE)
+            bin=0;
+        ++s.bins[constrain(bin, 0, BINS-1)];
+    }
+    s.meanerror=sum/count;
+}
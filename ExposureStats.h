@@ -0,0 +1,86 @@
+/* -*- C++ -*- */
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _EXPOSURE_STATS_H_
+#define _EXPOSURE_STATS_H_
+
+#include <Arduino.h>
+
+/**
+ * Ring buffer of recent exposure timing measurements, for checking
+ * how closely the delivered LED-on time matches the compiled
+ * Program::Exposure::us.  Only completed exposures are recorded;
+ * skipped or cancelled ones are not comparable.
+ */
+class ExposureStats {
+public:
+
+    /// exposures remembered
+    static const unsigned char DEPTH=16;
+    /// histogram of timing error
+    static const unsigned char BINS=8;
+    /// width of each histogram bin in microseconds
+    static const long BINWIDTH=50;
+    /// error at the bottom of bin 0; bins 0 and BINS-1 also catch outliers
+    static const long BINBASE=-(BINS/2)*BINWIDTH;
+
+    /// one measured exposure
+    struct Record {
+        unsigned long commanded;  ///< compiled duration, us
+        long error;               ///< measured LED-on time less commanded, us
+        unsigned int worstloop;   ///< longest foreground loop iteration, us
+    };
+
+    /// aggregate over the records currently held
+    struct Summary {
+        unsigned char count;
+        long minerror, maxerror, meanerror;   ///< us
+        unsigned int worstloop;               ///< us
+        unsigned char bins[BINS];
+    };
+
+    ExposureStats();
+
+    /// forget all records
+    void clear();
+
+    /// add a completed exposure, overwriting the oldest if full
+    /// @param commandedus compiled duration in us
+    /// @param measuredus LED-on time in us, summed over pause segments
+    /// @param worstloopus longest foreground loop iteration in us
+    void record(unsigned long commandedus, unsigned long measuredus, unsigned long worstloopus);
+
+    /// number of records held (<= DEPTH)
+    unsigned char getCount() const {
+        return count;
+    }
+
+    /// @param which 0 is the most recent
+    const Record &getRecord(unsigned char which) const;
+
+    /// compute min/max/mean/histogram of the records held
+    void summarise(Summary &s) const;
+
+private:
+    Record records[DEPTH];
+    unsigned char head;   ///< where the next record goes
+    unsigned char count;
+};
+
+#endif // _EXPOSURE_STATS_H_
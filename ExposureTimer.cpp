@@ -0,0 +1,313 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "ExposureTimer.h"
+
+ExposureTimer *ExposureTimer::eng=NULL;
+
+ISR(TIMER5_COMPA_vect)
+{
+    ExposureTimer::tick();
+}
+
+ISR(TIMER5_COMPB_vect)
+{
+    ExposureTimer::deadline();
+}
+
+ExposureTimer::ExposureTimer(LEDDriver &led)
+    : leddriver(led)
+{
+    eng=this;
+
+    remaining=0;
+    ontime=onat=0;
+    running=false;
+    done=false;
+    split=false;
+    paused=false;
+    pausedcount=0;
+    firstoffset=lastoffset=0;
+}
+
+void ExposureTimer::begin()
+{
+    disableTick();
+
+    // CTC with OCR5A as top, clk/8 -> 2MHz count, 1ms period
+    TCCR5A=0;
+    TCCR5B=_BV(WGM52) | _BV(CS51);
+    OCR5A=TICK_TOP;
+    TCNT5=0;
+}
+
+void ExposureTimer::enableTick()
+{
+    TIFR5=_BV(OCF5A) | _BV(OCF5B);    // discard any stale match
+    TIMSK5|=_BV(OCIE5A);
+}
+
+void ExposureTimer::disableTick()
+{
+    TIMSK5&=~(_BV(OCIE5A) | _BV(OCIE5B));
+}
+
+void ExposureTimer::start(unsigned long us, unsigned long cornerus, unsigned int hard, unsigned int soft,
+                          unsigned int cornerhard, unsigned int cornersoft, int cycleus, int cornercycleus)
+{
+    disableTick();
+
+    powers[0]=hard;
+    powers[1]=soft;
+    powers[2]=cornerhard;
+    powers[3]=cornersoft;
+    cornerfirst=cornerus < us;
+    remaining=cornerfirst ? us : cornerus;
+    tail=cornerfirst ? us-cornerus : cornerus-us;
+    if(tail == 0){
+        firstoffset=lastoffset=((long)cycleus+cornercycleus)/2;
+    }
+    else{
+        firstoffset=cornerfirst ? cornercycleus : cycleus;
+        lastoffset=cornerfirst ? cycleus : cornercycleus;
+    }
+    // a zone with no time at all never comes on
+    split=(tail != 0 && tail == remaining);
+    ontime=0;
+    paused=false;
+    running=false;
+    done=(remaining == 0);
+    if(done)
+        return;
+
+    switchOn();
+    markOn();
+
+    // the tick starts as the LEDs come on
+    uint8_t oldSREG=SREG;
+    cli();
+    TCNT5=0;
+    running=true;
+    enableTick();
+    arm();
+    SREG=oldSREG;
+}
+
+void ExposureTimer::pause()
+{
+    uint8_t oldSREG=SREG;
+    cli();
+    disableTick();
+    if(!running){
+        SREG=oldSREG;
+        return;
+    }
+
+    leddriver.allOff();
+    markOff();
+    // a tick that ended before the ISR got in is charged here, as
+    // elapsed() would have counted it
+    if(TIFR5 & _BV(OCF5A)){
+        unsigned long r=remaining;
+        remaining=r > TICK_US ? r-TICK_US : 0;
+        TIFR5=_BV(OCF5A);
+    }
+    pausedcount=TCNT5;
+    running=false;
+    paused=true;
+    SREG=oldSREG;
+}
+
+void ExposureTimer::resume()
+{
+    if(!paused)
+        return;
+
+    // another on/off cycle; charge each zone's light against its own
+    // time, but never so much that the end is already past
+    unsigned long now=pausedcount/COUNTS_PER_US;
+    long last=(long)remaining-lastoffset;
+    long first=(long)(remaining-tail)-firstoffset;
+    remaining=last > (long)now ? last : now+1;
+    if(!split && tail != 0){
+        // a deadline met just as the pause came
+        if(first <= (long)now)
+            split=true;
+        else
+            tail=first < (long)remaining ? remaining-first : 0;
+    }
+
+    switchOn();
+    markOn();
+
+    // carry on from part-way through the tick we paused in
+    uint8_t oldSREG=SREG;
+    cli();
+    TCNT5=pausedcount;
+    paused=false;
+    running=true;
+    enableTick();
+    arm();
+    SREG=oldSREG;
+}
+
+void ExposureTimer::switchOn()
+{
+    // the zone that finishes first may have done so before a pause, or
+    // not be used at all
+    if(!split)
+        leddriver.exposeOn(powers[0], powers[1], powers[2], powers[3]);
+    else if(cornerfirst)
+        leddriver.exposeOn(powers[0], powers[1], LEDDriver::FINE_OFF, LEDDriver::FINE_OFF);
+    else
+        leddriver.exposeOn(LEDDriver::FINE_OFF, LEDDriver::FINE_OFF, powers[2], powers[3]);
+}
+
+void ExposureTimer::stop()
+{
+    disableTick();
+    leddriver.allOff();
+    if(running)
+        markOff();
+    running=false;
+    paused=false;
+    remaining=0;
+}
+
+unsigned long ExposureTimer::elapsed() const
+{
+    if(!running)
+        return pausedcount/COUNTS_PER_US;
+    unsigned long e=TCNT5/COUNTS_PER_US;
+    // a tick that has just ended is only counted once the ISR gets in
+    if(TIFR5 & _BV(OCF5A))
+        e=TICK_US+TCNT5/COUNTS_PER_US;
+    return e;
+}
+
+unsigned long ExposureTimer::getRemaining() const
+{
+    uint8_t oldSREG=SREG;
+    cli();
+    unsigned long r=remaining;
+    if(running || paused){
+        unsigned long e=elapsed();
+        r=r > e ? r-e : 0;
+    }
+    SREG=oldSREG;
+    return r;
+}
+
+void ExposureTimer::setRemaining(unsigned long us)
+{
+    uint8_t oldSREG=SREG;
+    cli();
+    if(running || paused){
+        remaining=elapsed()+(us ? us : 1);
+        if(running)
+            arm();
+    }
+    SREG=oldSREG;
+}
+
+unsigned long ExposureTimer::getOnTime() const
+{
+    uint8_t oldSREG=SREG;
+    cli();
+    unsigned long t=ontime;
+    if(running)
+        t+=micros()-onat;
+    SREG=oldSREG;
+    return t;
+}
+
+void ExposureTimer::markOn()
+{
+    onat=micros();
+}
+
+void ExposureTimer::markOff()
+{
+    ontime+=micros()-onat;
+}
+
+void ExposureTimer::arm()
+{
+    while(running){
+        // the next deadline, us from the start of this tick
+        unsigned long at=remaining;
+        if(!split && tail != 0)
+            at=remaining > tail ? remaining-tail : 0;
+        if(at >= TICK_US){
+            TIMSK5&=~_BV(OCIE5B);
+            return;
+        }
+
+        unsigned int count=at*COUNTS_PER_US;
+        if(count > (unsigned int)(TCNT5+LEAD)){
+            OCR5B=count;
+            TIFR5=_BV(OCF5B);
+            TIMSK5|=_BV(OCIE5B);
+            return;
+        }
+
+        // too close to catch with compare B; wait it out here
+        while(TCNT5 < count && !(TIFR5 & _BV(OCF5A)))
+            ;
+        expire();
+    }
+}
+
+bool ExposureTimer::expire()
+{
+    if(!split && tail != 0){
+        // the first zone's deadline; the other carries on
+        leddriver.zoneOff(cornerfirst);
+        split=true;
+        return false;
+    }
+
+    leddriver.allOff();
+    markOff();
+    running=false;
+    done=true;
+    remaining=0;
+    TIMSK5&=~(_BV(OCIE5A) | _BV(OCIE5B));
+    return true;
+}
+
+void ExposureTimer::tick()
+{
+    if(NULL == eng || !eng->running)
+        return;
+
+    // compare B has met any deadline before this one
+    unsigned long r=eng->remaining;
+    eng->remaining=r > TICK_US ? r-TICK_US : 0;
+    eng->arm();
+}
+
+void ExposureTimer::deadline()
+{
+    if(NULL == eng || !eng->running)
+        return;
+
+    TIMSK5&=~_BV(OCIE5B);
+    if(!eng->expire())
+        eng->arm();
+}
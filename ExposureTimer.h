@@ -0,0 +1,169 @@
+/* -*- C++ -*- */
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _EXPOSURE_TIMER_H_
+#define _EXPOSURE_TIMER_H_
+
+#include <Arduino.h>
+#include "LEDDriver.h"
+
+/**
+ * Interrupt-driven exposure engine.  Timer5 runs in CTC mode with a
+ * 1ms period, counting half-microseconds, and its compare-A interrupt
+ * counts the remaining exposure down a tick at a time.  When a
+ * deadline falls inside the coming tick, compare B is set to the
+ * count at which it lands and its interrupt switches the LEDs off
+ * there, so exposures are timed to the microsecond no matter how long
+ * the foreground spends scanning keys or redrawing the LCD.
+ *
+ * The centre and corner zones may run for different times; the zone
+ * that finishes first is switched off by the ISR at its own deadline,
+ * so an edge burn or dodge happens within the base exposure.
+ *
+ * The foreground starts, pauses, resumes and stops exposures; only
+ * the expiry happens in the ISR.  A pause keeps the partially-elapsed
+ * tick, and each resume charges the lamp's per-cycle offset (see
+ * LampModel) since Program::compile() only allowed for one on/off
+ * cycle.
+ *
+ * Supports only one engine as it uses a static pointer to reach the
+ * object from the interrupt handler.  Timer5 drives PWM on pins 44-46
+ * only, none of which are used for PWM here.
+ */
+class ExposureTimer {
+public:
+
+    ExposureTimer(LEDDriver &led);
+
+    /// configure timer hardware; interrupt stays disabled until start()
+    void begin();
+
+    /// switch the LEDs on and arm the countdown
+    /// @param us duration of exposure in the centre zone
+    /// @param cornerus duration in the corner zone; whichever zone
+    ///        finishes first is switched off by the ISR at its own deadline
+    /// @param hard fine power for the centre hard channel (LEDDriver units)
+    /// @param soft fine power for the centre soft channel (LEDDriver units)
+    /// @param cornerhard as hard, corner zone
+    /// @param cornersoft as soft, corner zone
+    /// @param cycleus extra light per on/off cycle of the centre zone
+    ///        (LampModel), charged against its time on each resume
+    /// @param cornercycleus as cycleus, corner zone
+    void start(unsigned long us, unsigned long cornerus, unsigned int hard, unsigned int soft,
+               unsigned int cornerhard, unsigned int cornersoft, int cycleus=0, int cornercycleus=0);
+
+    /// switch off and freeze the countdown
+    void pause();
+
+    /// switch back on and continue the countdown
+    void resume();
+
+    /// switch off and abandon the remainder of the exposure
+    void stop();
+
+    /// LEDs on and counting down
+    bool isRunning() const {
+        return running;
+    }
+
+    /// frozen by pause()
+    bool isPaused() const {
+        return paused;
+    }
+
+    /// exposure ran to completion (cleared by start())
+    bool isDone() const {
+        return done;
+    }
+
+    /// microseconds still to be exposed, in the zone that finishes last
+    unsigned long getRemaining() const;
+
+    /// replace the microseconds still to be exposed (DoseMeter); 0 ends
+    /// the exposure straight away
+    void setRemaining(unsigned long us);
+
+    /// microseconds the LEDs have actually been on since start(),
+    /// summed over all segments between pauses
+    unsigned long getOnTime() const;
+
+    /// called only from the compare-A ISR
+    static void tick();
+
+    /// called only from the compare-B ISR
+    static void deadline();
+
+private:
+
+    /// counts per 1ms tick at 16MHz/8
+    static const unsigned int TICK_TOP=1999;
+    static const unsigned long TICK_US=1000;
+    static const unsigned char COUNTS_PER_US=2;
+    /// a deadline this few counts ahead is waited out rather than
+    /// risking compare B being set after the count has gone by
+    static const unsigned char LEAD=16;
+
+    void enableTick();
+    void disableTick();
+
+    /// point compare B at the next deadline if it is in this tick, or
+    /// meet it here if it is (all but) due; interrupts off
+    void arm();
+    /// a deadline has come: the first zone's, or the end of the exposure
+    /// @return true if the exposure is over
+    bool expire();
+    /// us into the current tick, including one that has ended but not
+    /// yet been counted; interrupts off
+    unsigned long elapsed() const;
+
+    /// LEDs on at the stored powers, less a zone that has finished
+    void switchOn();
+
+    /// note that the LEDs just came on / went off
+    void markOn();
+    void markOff();
+
+    LEDDriver &leddriver;
+    /// fine powers in LEDDriver argument order
+    unsigned int powers[4];
+
+    /// the zone that finishes first, and how long the other one runs
+    /// on after it (0: both finish together)
+    bool cornerfirst;
+    unsigned long tail;
+
+    // shared between ISR and foreground
+    /// us from the start of the current tick to the last zone's end
+    volatile unsigned long remaining;
+    volatile bool running, done;
+    /// the zone that finishes first has done so
+    volatile bool split;
+    volatile unsigned long ontime, onat;
+
+    bool paused;
+    /// timer count at pause, restored on resume
+    unsigned int pausedcount;
+    /// per-cycle lamp offsets of the zone that finishes first and the
+    /// other one, us; both the mean when the zones finish together
+    int firstoffset, lastoffset;
+
+    static ExposureTimer *eng;
+};
+
+#endif // _EXPOSURE_TIMER_H_
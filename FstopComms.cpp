@@ -23,8 +23,8 @@ const char *FstopComms::BAD_READ=     "    Bad Read    ";
 const char *FstopComms::CONNECTED=    " Host Connected ";
 const char *FstopComms::CHECKSUM_FAIL=" Checksum Fail  ";
 
-FstopComms::FstopComms(LiquidCrystal &l)
-    : disp(l)
+FstopComms::FstopComms(LiquidCrystal &l, ExposureStats &s)
+    : disp(l), stats(s)
 {
     lastlcd=lasttx=lastrx=micros();
     connected=false;
@@ -133,6 +133,17 @@ void FstopComms::rx(char ch)
             }
             break;
 
+            // request for exposure timing summary
+        case COM_STATS:
+            if(bufwant == 1){
+                // wait for checksum
+                bufwant=2;
+            }
+            else{
+                respondStats();
+            }
+            break;
+
             // disconnect
         default:
             reset();
@@ -191,6 +202,38 @@ void FstopComms::respondWrite()
     txCmd();
 }
 
+void FstopComms::respondStats()
+{
+    if(!checkcheck())
+        return;
+
+    ExposureStats::Summary sum;
+    stats.summarise(sum);
+
+    // same header shape as a read response, address unused
+    cmd[PKT_CMD]=COM_STATSACK;
+    cmd[PKT_ADDR]=0;
+    cmd[PKT_ADDR+1]=0;
+    buflen=PKT_SHORTHDR;
+    put(sum.count, 1);
+    put(sum.minerror, 4);
+    put(sum.maxerror, 4);
+    put(sum.meanerror, 4);
+    put(sum.worstloop, 2);
+    for(unsigned char b=0;b<ExposureStats::BINS;++b)
+        put(sum.bins[b], 1);
+    cmd[PKT_LEN]=buflen-PKT_SHORTHDR;
+
+    txCmd();
+}
+
+void FstopComms::put(unsigned long v, char bytes)
+{
+    while(bytes--){
+        cmd[buflen++]=(v >> (8*bytes)) & 0xFF;
+    }
+}
+
 unsigned int FstopComms::getAddr()
 {
     unsigned char c1=cmd[PKT_ADDR], c0=cmd[PKT_ADDR+1];   // big-endian
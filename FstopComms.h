@@ -23,6 +23,7 @@
 #include <LiquidCrystal.h>
 #include <EEPROM.h>
 #include "EEPROMLayout.h"
+#include "ExposureStats.h"
 
 /**
  * Serial communication state-machine
@@ -41,8 +42,10 @@ class FstopComms {
   static const char COM_KEEPALIVE=0x80;
   static const char COM_READ=0x81;
   static const char COM_WRITE=0x82;
+  static const char COM_STATS=0x83;
   static const char COM_READACK=0x91;
   static const char COM_WRITEACK=0x92;
+  static const char COM_STATSACK=0x93;
   static const char COM_NAK=0x9F;
   static const char COM_CHKFAIL=0x9E;
 
@@ -58,7 +61,8 @@ class FstopComms {
   static const int EEPROM_MIN_READ=0x0000;
   static const int EEPROM_MIN_WRITE=EE_CONFIGTOP;
   static const int EEPROM_MAX_READ=EE_TOP;
-  static const int EEPROM_MAX_WRITE=EE_TOP;
+  // calibration above the slots is only ever measured, never sent
+  static const int EEPROM_MAX_WRITE=EE_SLOTTOP;
 
   static const char *BAD_WRITE;
   static const char *BAD_READ;
@@ -67,7 +71,7 @@ class FstopComms {
 
 public:
 
-  FstopComms(LiquidCrystal &l);
+  FstopComms(LiquidCrystal &l, ExposureStats &s);
 
   /// initialise port
   void begin();
@@ -101,8 +105,15 @@ private:
 
   void respondRead();
   void respondWrite();
+  /// send exposure timing summary: count, min/max/mean error (us,
+  /// 4 bytes each), worst loop (us, 2 bytes), histogram bins
+  void respondStats();
+
+  /// append big-endian value to buffer
+  void put(unsigned long v, char bytes);
 
   LiquidCrystal &disp;
+  ExposureStats &stats;
   unsigned long lastrx, lasttx, lastlcd;  ///< times of recent events
   bool incmd, connected;                  ///< connection state
   char cmd[PKT_BUFFER];                   ///< data buffer
@@ -17,6 +17,9 @@
 */
 
 #include "FstopTimer.h"
+#include "TextReader.h"
+#include "LightSweep.h"
+#include "RecordWriter.h"
 
 const char *FstopTimer::VERSION="LED F/Stop Timer ";
 
@@ -28,6 +31,7 @@ FstopTimer::voidfunc FstopTimer::sm_enter[]
       &FstopTimer::st_edit_ev_enter, 
       &FstopTimer::st_edit_grade_enter, 
       &FstopTimer::st_edit_text_enter, 
+      &FstopTimer::st_edit_nest_enter,
       &FstopTimer::st_exec_enter,
       &FstopTimer::st_focus_enter,
       &FstopTimer::st_io_enter, 
@@ -38,13 +42,16 @@ FstopTimer::voidfunc FstopTimer::sm_enter[]
       &FstopTimer::st_test_changeb_enter, 
       &FstopTimer::st_test_changegrade_enter, 
       &FstopTimer::st_test_changes_enter, 
+      &FstopTimer::st_test_changerows_enter,
+      &FstopTimer::st_test_changegstep_enter,
       &FstopTimer::st_config_enter,
       &FstopTimer::st_config_dry_enter,
       &FstopTimer::st_config_rotary_enter,
       &FstopTimer::st_calibrate_light_enter,
       &FstopTimer::st_paper_enter,
       &FstopTimer::st_paper_display_enter,
-      &FstopTimer::st_paper_load_enter
+      &FstopTimer::st_paper_load_enter,
+      &FstopTimer::st_diag_enter
  };
 /// functions to exec when polling within each state
 FstopTimer::voidfunc FstopTimer::sm_poll[]
@@ -54,6 +61,7 @@ FstopTimer::voidfunc FstopTimer::sm_poll[]
       &FstopTimer::st_edit_ev_poll,
       &FstopTimer::st_edit_grade_poll,
       &FstopTimer::st_edit_text_poll,
+      &FstopTimer::st_edit_nest_poll,
       &FstopTimer::st_exec_poll, 
       &FstopTimer::st_focus_poll, 
       &FstopTimer::st_io_poll, 
@@ -64,13 +72,16 @@ FstopTimer::voidfunc FstopTimer::sm_poll[]
       &FstopTimer::st_test_changeb_poll,
       &FstopTimer::st_test_changegrade_poll,
       &FstopTimer::st_test_changes_poll,
+      &FstopTimer::st_test_changerows_poll,
+      &FstopTimer::st_test_changegstep_poll,
       &FstopTimer::st_config_poll,
       &FstopTimer::st_config_dry_poll,
       &FstopTimer::st_config_rotary_poll,
       &FstopTimer::st_calibrate_light_poll,
       &FstopTimer::st_paper_poll,
       &FstopTimer::st_paper_display_poll,
-      &FstopTimer::st_paper_load_poll
+      &FstopTimer::st_paper_load_poll,
+      &FstopTimer::st_diag_poll
 };
 
 FstopTimer::FstopTimer(LiquidCrystal &l, SMSKeypad &k, RotaryEncoder &r,
@@ -78,21 +89,24 @@ FstopTimer::FstopTimer(LiquidCrystal &l, SMSKeypad &k, RotaryEncoder &r,
                        ButtonDebounce &fs,
                        LEDDriver &led, 
                        TSL2561 &t, char p_b, char p_bl, char p_sd)
-    : disp(l), keys(k), rotary(r), button(b), footswitch(fs), leddriver(led), tsl(t),
+    : disp(l), keys(k), rotary(r), button(b), footswitch(fs), leddriver(led),
       smsctx(&inbuf[0], 18, &disp, 0, 0),
-      deckey(keys), comms(l),
+      deckey(keys), comms(l, stats),
+      sensor(t), meter(sensor),
       expctx(&inbuf[0], 1, 2, &disp, 0, 2, true),
       gradectx(&inbuf[0], 3, 0, &disp, 7, 1, false),
       stepctx(&inbuf[0], 1, 2, &disp, 0, 1, false),
       dryctx(&inbuf[0], 0, 2, &disp, 0, 1, false),
       intctx(&inbuf[0], 1, 0, &disp, 0, 1, false),
-      paperctx(&inbuf[0], 1, 0, &disp, 0, 1, false),
-      exec(l, keys, button, footswitch, led),
+      nestctx(&inbuf[0], 1, 0, &disp, 13, 3, false),
+      papers(library),
+      exec(l, keys, button, footswitch, led, stats, lamp, meter),
       pin_beep(p_b), pin_backlight(p_bl), pin_sd(p_sd) 
 {
     // init libraries
     prevstate=curstate=ST_MAIN;
     focusphase=-1;
+    paperpos=0;
 }
 
 void FstopTimer::setBacklight()
@@ -125,23 +139,40 @@ void FstopTimer::begin()
     drydown_apply = false;
     
     splitgrade = EEPROM.read(EE_SPLITGRADE);
+    integrating = EEPROM.read(EE_INTEGRATE) == 1;
+    powerfit = EEPROM.read(EE_POWERFIT);
+    if(powerfit > POWERFIT_MAX || powerfit % POWERFIT_STEP != 0)
+        powerfit=0;
     
     current.clear();
     stripbase=(EEPROM.read(EE_STRIPBASE)<<8) | EEPROM.read(EE_STRIPBASE+1);
     stripstep=(EEPROM.read(EE_STRIPSTEP)<<8) | EEPROM.read(EE_STRIPSTEP+1);
     stripcover=EEPROM.read(EE_STRIPCOV);
     stripgrade=EEPROM.read(EE_STRIPGRADE);
+    striprows=EEPROM.read(EE_STRIPROWS);
+    if(striprows < 1 || striprows > Program::MAXROWS)
+        striprows=1;
+    stripgradestep=EEPROM.read(EE_STRIPGSTEP);
+    if(stripgradestep > MAXGRADE-MINGRADE)
+        stripgradestep=0;
+    stripstagger=EEPROM.read(EE_STRIPSTAG) == 1;
 
     // prevent client-overwrite shenanigans
     EEPROM.write(EE_VERSION, VERSIONCODE);
 
     rotexp=EEPROM.read(EE_ROTARY);
+    lamp.load();
+    balance.load();
+    meter.load();
 
     comms.begin();
     exec.begin();
     
-    //Load the default / first paper
-    currentPaper.init(sdready);
+    // papers in use last time, or the first paper
+    bool rebuilt=library.begin(sdready);
+    papers.begin();
+    if(rebuilt)
+        papers.revalidate();
 
     // boot the state machine
     changeState(ST_SPLASH);
@@ -159,6 +190,25 @@ void FstopTimer::toggleSplitgrade()
     EEPROM.write(EE_SPLITGRADE, splitgrade);
 }
 
+void FstopTimer::toggleIntegrating()
+{
+    integrating=!integrating;
+    EEPROM.write(EE_INTEGRATE, integrating);
+}
+
+void FstopTimer::cyclePowerFit()
+{
+    powerfit+=POWERFIT_STEP;
+    if(powerfit > POWERFIT_MAX)
+        powerfit=0;
+    EEPROM.write(EE_POWERFIT, powerfit);
+}
+
+unsigned char FstopTimer::fitWindow()
+{
+    return leddriver.isLinear(true) && leddriver.isLinear(false) ? powerfit : 0;
+}
+
 void FstopTimer::st_splash_enter()
 {
     disp.clear();
@@ -254,7 +304,7 @@ void FstopTimer::st_main_poll()
 
 void FstopTimer::execCurrent()
 {
-    if(!current.compile(drydown_apply ? drydown : 0, splitgrade, currentPaper)){
+    if(!current.compile(drydown_apply ? drydown : 0, splitgrade, fitWindow(), papers.current(), lamp, balance)){
         disp.print("Cannot Print");
         disp.setCursor(0, 1);
         disp.print("Dodges > Base");
@@ -271,7 +321,8 @@ void FstopTimer::execCurrent()
 
 void FstopTimer::execTest()
 {
-    strip.configureStrip(stripbase, stripstep, stripcover, stripgrade, currentPaper);
+    strip.configureStrip(stripbase, stripstep, stripcover, stripgrade,
+                         striprows, stripgradestep, stripstagger, papers.current());
     exec.setProgram(&strip);
     changeState(ST_EXEC);
 }
@@ -280,10 +331,11 @@ void FstopTimer::st_exec_enter()
 {
     Program *p=exec.getProgram();
     // we assume it compiles if we're in this state
-    p->compile(drydown_apply ? drydown : 0, splitgrade, currentPaper);
+    p->compile(drydown_apply ? drydown : 0, splitgrade, fitWindow(), papers.current(), lamp, balance);
     disp.clear();
     exec.setDrydown(drydown_apply);
     exec.setSplitgrade(splitgrade);
+    exec.setIntegrating(integrating && meter.isValid());
 
     if(focusphase >= 0){
         exec.changePhase(focusphase);
@@ -293,6 +345,10 @@ void FstopTimer::st_exec_enter()
 
 void FstopTimer::st_exec_poll()
 {
+    // an exposure in progress owns the keypad and buttons
+    if(exec.poll())
+        return;
+
     if(button.hadPress() || footswitch.hadPress()){
         exec.expose();
         return;
@@ -361,10 +417,11 @@ void FstopTimer::st_focus_enter()
 {
     disp.clear();
     disp.print("       Focus!");    
-    leddriver.focusOn(currentPaper.getAmountHard(stripgrade),
-                      currentPaper.getAmountSoft(stripgrade),
-                      currentPaper.getAmountHard(stripgrade),
-                      currentPaper.getAmountSoft(stripgrade));
+    unsigned int hard=papers.current().getFineHard(stripgrade);
+    unsigned int soft=papers.current().getFineSoft(stripgrade);
+    unsigned int cornerhard, cornersoft;
+    balance.apply(hard, soft, cornerhard, cornersoft);
+    leddriver.focusOn(hard, soft, cornerhard, cornersoft);
 }
 
 void FstopTimer::st_focus_poll()
@@ -432,6 +489,25 @@ void FstopTimer::st_edit_poll()
         case 'D':
             changeState(ST_EDIT_GRADE);
             break;
+        case '0':
+            // nest inside an earlier step; base can't be nested
+            if(expnum == 0)
+                errorBeep();
+            else
+                changeState(ST_EDIT_NEST);
+            break;
+        case '9':
+            // corners only, during the base exposure; not for the base
+            if(expnum == 0)
+                errorBeep();
+            else{
+                Program::Step &st=current.getStep(expnum);
+                st.corner=!st.corner;
+                if(st.corner)
+                    st.parent=0;
+                st.display(disp, dispbuf, false);
+            }
+            break;
         case '#':
         case '*':
             exec.setProgram(&current);
@@ -488,10 +564,9 @@ void FstopTimer::st_edit_grade_poll()
 {
     if(deckey.poll()){
         if(expctx.exitcode != Keypad::KP_C){
-            // current.getStep(expnum).grade=constrain(gradectx.result, MINGRADE, MAXGRADE);
-            // Round to units of 5. Always rounds down, but that's ok.
-            unsigned char temp = (gradectx.result / 5)*5;
-            current.getStep(expnum).grade=constrain(temp, currentPaper.minGrade, currentPaper.maxGrade);
+            // any whole grade; the paper curve is interpolated
+            int temp = gradectx.result;
+            current.getStep(expnum).grade=constrain(temp, papers.current().minGrade, papers.current().maxGrade);
         }
         current.getStep(expnum).display(disp, dispbuf, false);
         // sly state change without expnum=0
@@ -515,6 +590,34 @@ void FstopTimer::st_edit_text_poll()
     }
 }
 
+void FstopTimer::st_edit_nest_enter()
+{
+    disp.setCursor(0, 3);
+    disp.print("Inside step:        ");
+    disp.setCursor(0, 3);
+    deckey.setContext(&nestctx);
+}
+
+void FstopTimer::st_edit_nest_poll()
+{
+    if(deckey.poll()){
+        if(nestctx.exitcode != Keypad::KP_C){
+            // 1 (the base) un-nests; otherwise any earlier step
+            int par=nestctx.result-1;
+            if(par >= 0 && par < expnum){
+                current.getStep(expnum).parent=par;
+                if(par != 0)
+                    current.getStep(expnum).corner=false;
+            }
+            else
+                errorBeep();
+        }
+        current.getStep(expnum).display(disp, dispbuf, false);
+        // sly state change without expnum=0
+        curstate=ST_EDIT;
+    }
+}
+
 void FstopTimer::st_io_enter()
 {
     disp.clear();
@@ -633,13 +736,13 @@ void FstopTimer::st_paper_display_enter()
     disp.clear();
     disp.print("Paper:");
     disp.setCursor(0, 1);
-    disp.print(currentPaper.getName());
+    disp.print(papers.current().getName());
     disp.setCursor(0, 2);
     String line;
     line = "Grades: ";
-    line += currentPaper.minGrade;
+    line += papers.current().minGrade;
     line += "-";
-    line += currentPaper.maxGrade;
+    line += papers.current().maxGrade;
     disp.print(line);
 }
 
@@ -658,23 +761,93 @@ void FstopTimer::st_paper_display_poll()
 }
 
 void FstopTimer::st_paper_load_enter()
+{
+    // pick up papers added or edited since boot
+    if(library.refresh())
+        papers.revalidate();
+    if(paperpos >= library.getCount())
+        paperpos=0;
+    showPaperPage();
+    rotary.getDelta();
+}
+
+void FstopTimer::showPaperPage()
 {
     disp.clear();
-    disp.print("Select Load Paper");
-    deckey.setContext(&paperctx);
+    unsigned int n=library.getCount();
+    if(0 == n){
+        disp.print("No papers on card");
+        disp.setCursor(0, 1);
+        disp.print("C: Back");
+        return;
+    }
+
+    disp.print("Paper ");
+    disp.print(paperpos+1);
+    disp.print("/");
+    disp.print(n);
+    disp.print(" #:Load");
+
+    // three to a page; names come from the index, not the papers
+    PaperLibrary::Record r;
+    unsigned int first=paperpos-paperpos%3;
+    for(unsigned int k=first;k < first+3 && k < n;++k){
+        disp.setCursor(0, 1+k-first);
+        disp.print(k == paperpos ? ">" : " ");
+        if(library.getRecord(k, r) && r.image.name[0]){
+            char name[Paper::NAMELEN];
+            strncpy(name, r.image.name, Paper::NAMELEN-1);
+            name[Paper::NAMELEN-1]='\0';
+            disp.print(name);
+        }
+        else{
+            disp.print(r.file);
+        }
+    }
 }
 
 void FstopTimer::st_paper_load_poll()
 {
-    if(deckey.poll()){
-        disp.clear();
-        char paper=paperctx.result;
+    unsigned int n=library.getCount();
+    int move=rotary.getDelta();
+    bool go=button.hadPress() || footswitch.hadPress();
+
+    if(keys.available()){
+        char ch=keys.readAscii();
+        switch(ch){
+        case 'A':
+            move=-1;
+            break;
+        case 'B':
+            move=1;
+            break;
+        case 'C':
+            changeState(ST_PAPER);
+            return;
+        case '#':
+            go=true;
+            break;
+        default:
+            errorBeep();
+        }
+    }
 
-        if(currentPaper.load(paper)){ 
+    if(0 == n)
+        return;
+
+    if(move != 0){
+        long pos=(long)paperpos+move;
+        paperpos=constrain(pos, 0L, (long)n-1);
+        showPaperPage();
+    }
+
+    if(go){
+        disp.clear();
+        if(papers.select(paperpos)){ 
             disp.print("Paper Loaded");
         }
         else{
-            disp.print("Paper not in 0..9");
+            disp.print("Cannot read paper");
             errorBeep();
         }
         delay(1000);
@@ -702,7 +875,7 @@ void FstopTimer::st_test_enter()
     disp.print(stripcover ? "Cover" : "Indiv");
     disp.print(" B:Change");
     disp.setCursor(0, 1);
-    disp.print("*: Change Grade");
+    disp.print("*:Grade 0:Rows 1:Pat");
 
     disp.setCursor(0, 2);
     disp.print("Grade:");
@@ -712,6 +885,14 @@ void FstopTimer::st_test_enter()
     itoa(stripgrade, buf, 10);
     used+=strlen(buf);
     disp.print(buf);
+    if(striprows > 1){
+        // e.g. "Grade:80 +20x3 Stag"
+        disp.print(" +");
+        disp.print((int)stripgradestep);
+        disp.print("x");
+        disp.print((int)striprows);
+        disp.print(stripstagger ? " Stag" : " Grid");
+    }
  
     disp.setCursor(0, 3);
     dtostrf(0.01f*stripbase, 0, 2, dispbuf);
@@ -758,6 +939,16 @@ void FstopTimer::st_test_poll()
             // change exposures
             changeState(ST_TEST_CHANGEGRADE);
             break;
+        case '0':
+            // change grade axis
+            changeState(ST_TEST_CHANGEROWS);
+            break;
+        case '1':
+            // toggle grid/staggered rows
+            stripstagger=!stripstagger;
+            EEPROM.write(EE_STRIPSTAG, stripstagger);
+            changeState(ST_TEST);
+            break;
         case '#':
             // perform exposure
             go=true;
@@ -772,7 +963,8 @@ void FstopTimer::st_test_poll()
     }
 
     if(go){
-        strip.configureStrip(stripbase, stripstep, stripcover, stripgrade, currentPaper);
+        strip.configureStrip(stripbase, stripstep, stripcover, stripgrade,
+                         striprows, stripgradestep, stripstagger, papers.current());
         exec.setProgram(&strip);
         changeState(ST_EXEC);
     }
@@ -808,7 +1000,7 @@ void FstopTimer::st_test_changegrade_poll()
 {
     if(deckey.poll()){
         if(gradectx.exitcode != Keypad::KP_C){
-             unsigned char temp = (gradectx.result / 5)*5;
+            int temp = gradectx.result;
             stripgrade=constrain(temp, MINGRADE, MAXGRADE);
             EEPROM.write(EE_STRIPGRADE, stripgrade);
         }
@@ -835,6 +1027,47 @@ void FstopTimer::st_test_changes_poll()
     }
 }
 
+void FstopTimer::st_test_changerows_enter()
+{
+    disp.clear();
+    disp.print("Grade rows (1-");
+    disp.print(Program::MAXROWS);
+    disp.print("):");
+    deckey.setContext(&intctx);
+}
+
+void FstopTimer::st_test_changerows_poll()
+{
+    if(deckey.poll()){
+        if(intctx.exitcode == Keypad::KP_C){
+            changeState(ST_TEST);
+            return;
+        }
+        striprows=constrain(intctx.result, 1, Program::MAXROWS);
+        EEPROM.write(EE_STRIPROWS, striprows);
+        changeState(striprows > 1 ? ST_TEST_CHANGEGSTEP : ST_TEST);
+    }
+}
+
+void FstopTimer::st_test_changegstep_enter()
+{
+    disp.clear();
+    disp.print("Grade step per row:");
+    deckey.setContext(&gradectx);
+}
+
+void FstopTimer::st_test_changegstep_poll()
+{
+    if(deckey.poll()){
+        if(gradectx.exitcode != Keypad::KP_C){
+            int temp=gradectx.result;
+            stripgradestep=constrain(temp, 0, MAXGRADE-MINGRADE);
+            EEPROM.write(EE_STRIPGSTEP, stripgradestep);
+        }
+        changeState(ST_TEST);
+    }
+}
+
 void FstopTimer::st_config_enter()
 {
     disp.clear();
@@ -843,7 +1076,15 @@ void FstopTimer::st_config_enter()
     disp.setCursor(0,1);
     disp.print("B:Brite D:Drydn"); 
     disp.setCursor(0,2);
-    disp.print("0:Cal Light");
+    disp.print("0:Cal Light 1:Diag");
+    disp.setCursor(0,3);
+    if(powerfit)
+        snprintf_P(dispbuf, 21, PSTR("C:Int %s 2:Fit %ds"),
+                   integrating ? "on" : "off", powerfit);
+    else
+        snprintf_P(dispbuf, 21, PSTR("C:Int %s 2:Fit off"),
+                   integrating ? "on" : "off");
+    disp.print(dispbuf);
 }
 
 void FstopTimer::st_config_poll()
@@ -866,9 +1107,20 @@ void FstopTimer::st_config_poll()
             // change drydown
             changeState(ST_CONFIG_DRY);
             break;
+        case 'C':
+            toggleIntegrating();
+            changeState(ST_CONFIG);
+            break;
         case '0':
             changeState(ST_CALIBRATE_LIGHT);
             break;
+        case '1':
+            changeState(ST_DIAG);
+            break;
+        case '2':
+            cyclePowerFit();
+            changeState(ST_CONFIG);
+            break;
         default:
             // main menu
             changeState(ST_MAIN);
@@ -879,7 +1131,19 @@ void FstopTimer::st_calibrate_light_enter()
 {
     disp.clear();
     disp.setCursor(0,0);
-    disp.print("#:Start");
+    if(balance.hasCentre())
+        disp.print("#:Start 5:Corner");
+    else
+        disp.print(balance.isValid() ? "#:Start 5:Even*" : "#:Start 5:Even");
+    disp.setCursor(0,1);
+    disp.print(meter.isValid() ? "1:Lamp Lag 4:Dose*" : "1:Lamp Lag 4:Dose");
+    disp.setCursor(0,2);
+    disp.print("2:Linearise 3:Raw");
+    disp.setCursor(0,3);
+    snprintf_P(dispbuf, 21, PSTR("Soft %s Hard %s"),
+               leddriver.isLinear(false) ? "lin" : "raw",
+               leddriver.isLinear(true) ? "lin" : "raw");
+    disp.print(dispbuf);
 }
 
 void FstopTimer::st_calibrate_light_poll()
@@ -893,6 +1157,39 @@ void FstopTimer::st_calibrate_light_poll()
                 delay(1000);
                 changeState(ST_CALIBRATE_LIGHT);
                 break;
+            case '1':
+                calibrateLampLag();
+                delay(1000);
+                changeState(ST_CALIBRATE_LIGHT);
+                break;
+            case '2':
+                // from the files already on the card
+                disp.clear();
+                disp.print(lineariseLightSource(SOFT) ? "Soft linearised" : "Soft: no data");
+                disp.setCursor(0, 1);
+                disp.print(lineariseLightSource(HARD) ? "Hard linearised" : "Hard: no data");
+                delay(1000);
+                changeState(ST_CALIBRATE_LIGHT);
+                break;
+            case '4':
+                disp.clear();
+                disp.print("Measuring Dose Ref");
+                disp.setCursor(0, 1);
+                disp.print(meter.calibrate(leddriver) ? "Saved" : "Too dim or bright");
+                delay(1000);
+                changeState(ST_CALIBRATE_LIGHT);
+                break;
+            case '5':
+                // centre first, then again with the sensor at a corner
+                calibrateBalance(balance.hasCentre());
+                delay(1000);
+                changeState(ST_CALIBRATE_LIGHT);
+                break;
+            case '3':
+                leddriver.clearResponse(false);
+                leddriver.clearResponse(true);
+                changeState(ST_CALIBRATE_LIGHT);
+                break;
             default:
                 // main menu
                 changeState(ST_MAIN);
@@ -901,57 +1198,271 @@ void FstopTimer::st_calibrate_light_poll()
 }
 
 void FstopTimer::calibrateLightSource(Contrast_Enum source)
+{
+    // the sweep and its writer are gone by the time the file is read back
+    if (recordLightSource(source)) {
+        disp.setCursor(0, 3);
+        disp.print(lineariseLightSource(source) ? "Linearised" : "Not linearised");
+    }
+}
+
+bool FstopTimer::recordLightSource(Contrast_Enum source)
 {
     char output_buffer[20];
-    File dataFile;
+    RecordWriter out(3, CAL_BINARY);
     SD.mkdir("/cal/");
-    if (source == SOFT) {
-        if (SD.exists("/cal/soft.txt")) {
-            SD.remove("/cal/soft.txt");
+    if (!out.open(calFile(source), CAL_BINARY ? NULL : "i, ir_spectrum, full_spectrum", 256)) {
+        disp.setCursor(0, 0);
+        disp.print("Error opening file");
+        return false;
+    }
+
+    disp.setCursor(0, 0);
+    if (source == SOFT){
+        disp.print("Reading Soft Light");
+    } else {
+        disp.print("Reading Hard Light");
+    }
+    LightSweep sweep(sensor, leddriver);
+    sweep.run(source == HARD);
+    snprintf_P(output_buffer, 20, PSTR("%2d pts err %d.%d%%"),
+               sweep.getPoints(), sweep.getError()/10, sweep.getError()%10);
+    disp.setCursor(0, 2);
+    disp.print(output_buffer);
+
+    // every level, as before, so the file reads the same
+    for (int i = 0; i <= 255 ; i++){
+        uint16_t row[3];
+        row[0] = i;
+        sweep.get(i, row[2], row[1]);
+        out.write(row);
+    }
+    out.close();
+    return true;
+}
+
+const char *FstopTimer::calFile(Contrast_Enum source)
+{
+    if (CAL_BINARY)
+        return source == SOFT ? "/cal/soft.bin" : "/cal/hard.bin";
+    return source == SOFT ? "/cal/soft.txt" : "/cal/hard.txt";
+}
+
+bool FstopTimer::lineariseLightSource(Contrast_Enum source)
+{
+    File dataFile = SD.open(calFile(source));
+    if (!dataFile)
+        return false;
+
+    uint16_t response[256];
+    int count = 0;
+    if (CAL_BINARY) {
+        // i, ir, full, two bytes each LSB first
+        uint8_t rec[6];
+        while (dataFile.read(rec, 6) == 6) {
+            unsigned int i = rec[0] | (rec[1] << 8);
+            if (i <= 255) {
+                response[i] = rec[4] | (rec[5] << 8);
+                ++count;
+            }
         }
-        dataFile = SD.open("/cal/soft.txt", FILE_WRITE);
     } else {
-        if (SD.exists("/cal/hard.txt")) {
-            SD.remove("/cal/hard.txt");
+        TextReader in(dataFile);
+        in.nextLine();  // column headings
+        while (!in.atEnd()) {
+            int i, ir, full;
+            if (in.readInt(i) && in.readInt(ir) && in.readInt(full) && i >= 0 && i <= 255) {
+                // counts above 32767 come back wrapped, so take them unsigned
+                response[i] = (uint16_t)full;
+                ++count;
+            }
+            in.nextLine();
         }
-        dataFile = SD.open("/cal/hard.txt", FILE_WRITE);
     }
+    dataFile.close();
 
-    if (dataFile) {
-        disp.setCursor(0, 0);
-        if (source == SOFT){
-            disp.print("Reading Soft Light");
-        } else {
-            disp.print("Reading Hard Light");
+    return count == 256 && leddriver.setResponse(source == HARD, response);
+}
+
+void FstopTimer::st_diag_enter()
+{
+    ExposureStats::Summary sum;
+    stats.summarise(sum);
+
+    disp.clear();
+    disp.setCursor(0, 0);
+    snprintf_P(dispbuf, 21, PSTR("Timing n=%-3d A:Clr"), sum.count);
+    disp.print(dispbuf);
+    disp.setCursor(0, 1);
+    snprintf_P(dispbuf, 21, PSTR("min%6ld max%6ld"), sum.minerror, sum.maxerror);
+    disp.print(dispbuf);
+    disp.setCursor(0, 2);
+    snprintf_P(dispbuf, 21, PSTR("avg%6ld loop%5u"), sum.meanerror, sum.worstloop);
+    disp.print(dispbuf);
+
+    // histogram of error, one digit per bin
+    disp.setCursor(0, 3);
+    disp.print("us err ");
+    for(unsigned char b=0;b<ExposureStats::BINS;++b){
+        dispbuf[b]=sum.bins[b] > 9 ? '+' : '0'+sum.bins[b];
+    }
+    dispbuf[ExposureStats::BINS]='\0';
+    disp.print(dispbuf);
+}
+
+void FstopTimer::st_diag_poll()
+{
+    if(keys.available()){
+        char ch=keys.readAscii();
+        switch(ch){
+        case 'A':
+            stats.clear();
+            changeState(ST_DIAG);
+            break;
+        default:
+            changeState(ST_CONFIG);
         }
-        dataFile.println("i, ir_spectrum, full_spectrum");
-        for (int i = 0; i <= 255 ; i++){
+    }
+}
+
+void FstopTimer::calibrateLampLag()
+{
+    char output_buffer[21];
+
+    disp.clear();
+    disp.print("Measuring Lamp Lag");
+    for(unsigned char c=0;c<LampModel::CHANNELS;++c){
+        // brightest breakpoint first, so start at 1x
+        bool high=false;
+        for(unsigned char pt=0;pt<LampModel::POINTS;++pt){
+            unsigned char power=LampModel::pointPower(pt);
+
+            // same total on-time, once as one pulse and once as many, at
+            // 16x when that neither clips nor is clearly within reach
+            uint16_t single=0, multi=0;
+            for(unsigned char tries=0;tries < 3;++tries){
+                single=integratePulses(c, power, 1, LAG_PULSES*LAG_PULSEMS, high);
+                multi=integratePulses(c, power, LAG_PULSES, LAG_PULSEMS, high);
+                unsigned int top=max(single, multi);
+                if(high && top > LAG_CLIP)
+                    high=false;
+                else if(!high && top < LAG_CLIP/32)
+                    high=true;
+                else
+                    break;
+            }
+
             disp.setCursor(0, 2);
-            if (source == SOFT){
-                leddriver.calibrateOn(255, i, 255, i);      
-            } else {
-                leddriver.calibrateOn(i, 255, i, 255);      
+            if(max(single, multi) > LAG_CLIP || single < LAG_MINCOUNTS){
+                // keep what was there rather than store a wrong offset
+                snprintf_P(output_buffer, 21, PSTR("ch%d %3d %s"), c, power,
+                           single < LAG_MINCOUNTS ? "too dim" : "clipped");
+                disp.print(output_buffer);
+                continue;
             }
 
-            delay(500);
-            uint32_t full_luminosity = tsl.getFullLuminosity();
-            uint16_t ir_spectrum = full_luminosity >> 16;
-            uint16_t full_spectrum = full_luminosity & 0xFFFF;    
-            snprintf_P(output_buffer, 20, PSTR("%3d %6d %6d"), i, ir_spectrum, full_spectrum);
+            // the extra cycles account for the difference
+            long offset=lrint(1000.0f*LAG_PULSES*LAG_PULSEMS*((float)multi-single)
+                              /((LAG_PULSES-1)*(float)single));
+            lamp.setOffset(c, pt, offset);
+
+            snprintf_P(output_buffer, 21, PSTR("ch%d %3d %6ldus"), c, power, offset);
             disp.print(output_buffer);
-    
-            dataFile.print(i);
-            dataFile.print(",");
-            dataFile.print(ir_spectrum);
-            dataFile.print(",");
-            dataFile.println(full_spectrum);
         }
-        leddriver.allOff();
-        dataFile.close();
-    } else {
-        disp.setCursor(0, 0);
-        disp.print("Error opening file");
     }
+    leddriver.allOff();
+    lamp.save();
+
+    disp.setCursor(0, 3);
+    disp.print("Saved");
+}
+
+uint16_t FstopTimer::integratePulses(unsigned char channel, unsigned char power, unsigned char count, unsigned long ms, bool high)
+{
+    unsigned int on[LampModel::CHANNELS];
+    for(unsigned char c=0;c<LampModel::CHANNELS;++c)
+        on[c]=(c == channel) ? LEDDriver::toFine(power) : LEDDriver::FINE_OFF;
+
+    // exposeOn rather than allOff between pulses so the relay stays put
+    leddriver.exposeOn(LEDDriver::FINE_OFF, LEDDriver::FINE_OFF, LEDDriver::FINE_OFF, LEDDriver::FINE_OFF);
+
+    sensor.start(high ? TSL2561_GAIN_16X : TSL2561_GAIN_0X, TSL2561_INTEGRATIONTIME_402MS);
+    delay(LAG_LEADMS);
+
+    for(unsigned char i=0;i<count;++i){
+        unsigned long t=micros();
+        leddriver.exposeOn(on[0], on[1], on[2], on[3]);
+        while(micros()-t < ms*1000)
+            ;
+        leddriver.exposeOn(LEDDriver::FINE_OFF, LEDDriver::FINE_OFF, LEDDriver::FINE_OFF, LEDDriver::FINE_OFF);
+        delay(LAG_GAPMS);
+    }
+
+    // let the integration finish then take the full-spectrum channel
+    sensor.wait();
+    return sensor.getFull();
+}
+
+void FstopTimer::calibrateBalance(bool corner)
+{
+    disp.clear();
+    disp.print(corner ? "Balance at corner" : "Balance at centre");
+
+    bool ok=true;
+    for(unsigned char t=0;t<2;++t){
+        bool hard=(t == 1);
+        unsigned long centrezone=readZone(hard, false);
+        unsigned long cornerzone=readZone(hard, true);
+
+        disp.setCursor(0, 1+t);
+        snprintf_P(dispbuf, 21, PSTR("%s %6lu %6lu"), hard ? "Hard" : "Soft", centrezone, cornerzone);
+        disp.print(dispbuf);
+
+        if(corner)
+            ok=balance.setCorner(hard, centrezone, cornerzone) && ok;
+        else
+            balance.setCentre(hard, centrezone, cornerzone);
+    }
+
+    disp.setCursor(0, 3);
+    if(!corner)
+        disp.print("Sensor to corner, 5");
+    else
+        disp.print(ok ? "Saved" : "Check sensor places");
+}
+
+unsigned long FstopTimer::readZone(bool hard, bool corner)
+{
+    unsigned int on[LampModel::CHANNELS];
+    for(unsigned char c=0;c<LampModel::CHANNELS;++c)
+        on[c]=LEDDriver::FINE_OFF;
+    on[(corner ? LampModel::CORNER_HARD : LampModel::CENTER_HARD)+(hard ? 0 : 1)]=
+        LEDDriver::toFine(hard ? LEDDriver::LED_HARD_MAX : LEDDriver::LED_SOFT_MAX);
+    leddriver.exposeOn(on[0], on[1], on[2], on[3]);
+
+    // 16x unless that clips, then 1x standing in for it
+    bool high=true;
+    unsigned long sum;
+    for(;;){
+        sensor.start(high ? TSL2561_GAIN_16X : TSL2561_GAIN_0X, TSL2561_INTEGRATIONTIME_13MS, true);
+        sum=0;
+        bool clipped=false;
+        for(unsigned char i=0;i<BAL_SETTLE+BAL_WINDOWS;++i){
+            while(!sensor.poll())
+                ;
+            if(i < BAL_SETTLE)
+                continue;
+            sum+=sensor.getFull();
+            clipped=clipped || sensor.getFull() > BAL_CLIP;
+        }
+        if(!clipped || !high)
+            break;
+        high=false;
+    }
+    sensor.stop();
+    leddriver.allOff();
+
+    return (high ? sum : sum*16)/BAL_WINDOWS;
 }
 
 void FstopTimer::st_config_dry_enter()
@@ -1025,6 +1536,9 @@ void FstopTimer::changeState(int st)
 
 void FstopTimer::poll()
 {
+    // collect any finished sensor window
+    sensor.poll();
+
     // scan keypad
     keys.scan();
     button.scan();
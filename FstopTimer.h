@@ -29,6 +29,12 @@
 #include <SD.h>
 #include "TSL2561.h"
 #include "Paper.h"
+#include "PaperLibrary.h"
+#include "PaperCache.h"
+#include "LampModel.h"
+#include "ZoneBalance.h"
+#include "LightSensor.h"
+#include "DoseMeter.h"
 
 /**
  * State-machine implementing fstop timer
@@ -59,6 +65,7 @@ public:
     ST_EDIT_EV,
     ST_EDIT_GRADE,
     ST_EDIT_TEXT,
+    ST_EDIT_NEST,
     ST_EXEC,
     ST_FOCUS,
     ST_IO,
@@ -69,6 +76,8 @@ public:
     ST_TEST_CHANGEB,
     ST_TEST_CHANGEGRADE,
     ST_TEST_CHANGES,
+    ST_TEST_CHANGEROWS,
+    ST_TEST_CHANGEGSTEP,
     ST_CONFIG,
     ST_CONFIG_DRY,
     ST_CONFIG_ROTARY,
@@ -76,6 +85,7 @@ public:
     ST_PAPER,
 	ST_PAPER_DISPLAY,
     ST_PAPER_LOAD,
+    ST_DIAG,
     ST_COUNT
   };
 
@@ -112,24 +122,41 @@ private:
   ButtonDebounce &footswitch;
   SMSKeypad::Context smsctx;
   DecimalKeypad deckey;
+  /// exposure timing measurements, shared by exec and comms
+  ExposureStats stats;
+  /// lamp switching-edge compensation
+  LampModel lamp;
+  /// centre/corner zone gains
+  ZoneBalance balance;
   FstopComms comms;
-  TSL2561 tsl;
+  /// TSL2561 acquisition, polled every loop
+  LightSensor sensor;
+  /// closed-loop exposure references and state, shared with exec
+  DoseMeter meter;
   DecimalKeypad::Context expctx;
   DecimalKeypad::Context gradectx;
   DecimalKeypad::Context stepctx;
   DecimalKeypad::Context dryctx;
   DecimalKeypad::Context intctx;
-  DecimalKeypad::Context paperctx;
+  DecimalKeypad::Context nestctx;
 
   /// programs to execute
   Program current, strip;
   
-  Paper currentPaper;
+  /// everything in /papers on the card
+  PaperLibrary library;
+  /// recently used papers; current() is the one in use
+  PaperCache papers;
+  /// highlighted library entry on the load screen
+  unsigned int paperpos;
   
   /// current config for test strips
   int stripbase, stripstep;
   bool stripcover;
   unsigned char stripgrade;
+  /// grade rows, grade increment per row, rows offset along stops
+  unsigned char striprows, stripgradestep;
+  bool stripstagger;
 
   Executor exec;
 
@@ -141,6 +168,10 @@ private:
   char drydown; 
   /// use split grade exposures
   bool splitgrade;
+  /// end exposures on measured dose
+  bool integrating;
+  /// seconds to fit dodged/burnt exposures to by scaling power, 0 for off
+  unsigned char powerfit;
   /// exposure that is being edited
   int expnum;
   /// exposure change using rotary encoder
@@ -153,7 +184,7 @@ private:
 
   bool sdready;
   
-  LEDDriver leddriver;
+  LEDDriver &leddriver;
 
   /// all state-machine functions have this signature
   typedef void (FstopTimer::* voidfunc)();
@@ -180,6 +211,16 @@ private:
   /// invert and save the splitgrade bit
   void toggleSplitgrade();
 
+  /// invert and save the integrating-exposure bit
+  void toggleIntegrating();
+
+  /// step and save the power-fit window, wrapping to off
+  void cyclePowerFit();
+
+  /// powerfit if both LED types are linearised, otherwise 0: fitting
+  /// trusts relativeOutput() to hold the dose
+  unsigned char fitWindow();
+
   /// exec the current program
   void execCurrent();
 
@@ -191,6 +232,31 @@ private:
 
   /// Calibrate the light sources sources so we can linearize them
   void calibrateLightSource(Contrast_Enum);
+  /// sweep one LED type into its /cal file; kept out of line so the
+  /// sweep's stack is free again before lineariseLightSource() runs
+  bool recordLightSource(Contrast_Enum) __attribute__((noinline));
+
+  /// build the LEDDriver table for one LED type from its /cal file
+  /// @return false if the file is missing, incomplete or unusable
+  bool lineariseLightSource(Contrast_Enum);
+  /// sweep file for one LED type, per CAL_BINARY
+  static const char *calFile(Contrast_Enum);
+
+  /// measure each channel's per-cycle switching offset into lamp
+  void calibrateLampLag();
+
+  /// integrate one channel over a sensor window while pulsing it
+  /// @param high 16x gain rather than 1x
+  /// @return full-spectrum count
+  uint16_t integratePulses(unsigned char channel, unsigned char power, unsigned char count, unsigned long ms, bool high);
+
+  /// read both zones of both LED types with the sensor at the centre or
+  /// at a corner; the corner half computes and saves the balance
+  void calibrateBalance(bool corner);
+
+  /// steady light from one zone of one LED type alone at full power
+  /// @return channel-0 counts per 13.7ms window at 16x gain
+  unsigned long readZone(bool hard, bool corner);
 
   /// state-machine body
   void st_splash_enter();
@@ -209,6 +275,8 @@ private:
   void st_edit_grade_poll();
   void st_edit_text_enter();
   void st_edit_text_poll();
+  void st_edit_nest_enter();
+  void st_edit_nest_poll();
   void st_io_enter();
   void st_io_poll();
   void st_io_load_enter();
@@ -225,6 +293,10 @@ private:
   void st_test_changegrade_poll();
   void st_test_changes_enter();
   void st_test_changes_poll();
+  void st_test_changerows_enter();
+  void st_test_changerows_poll();
+  void st_test_changegstep_enter();
+  void st_test_changegstep_poll();
   void st_config_enter();
   void st_config_poll();
   void st_config_dry_enter();
@@ -239,10 +311,36 @@ private:
   void st_paper_display_poll();
   void st_paper_load_enter();
   void st_paper_load_poll();
+  /// one page of the library around paperpos
+  void showPaperPage();
+  void st_diag_enter();
+  void st_diag_poll();
+
+  // lamp lag measurement: LAG_PULSES short pulses vs one long one
+  static const unsigned char LAG_PULSES=10;
+  static const unsigned long LAG_PULSEMS=20;
+  static const unsigned long LAG_GAPMS=10;
+  static const unsigned long LAG_LEADMS=20;
+  // the 402ms window clips at 65535; readings above LAG_CLIP are taken
+  // again at 1x, and below LAG_MINCOUNTS the difference is mostly noise
+  static const unsigned int LAG_CLIP=60000;
+  static const unsigned int LAG_MINCOUNTS=1000;
+
+  // zone balance readings: windows skipped after switch-on, windows
+  // averaged, and the count above which 16x is taken as clipped
+  static const unsigned char BAL_SETTLE=2;
+  static const unsigned char BAL_WINDOWS=16;
+  static const unsigned int BAL_CLIP=4000;
+
+  // light source sweeps go to /cal/*.bin instead of the /cal/*.txt CSV
+  static const bool CAL_BINARY=false;
 
   // backlight bounds
   static const char BL_MIN=0;
   static const char BL_MAX=8;
+  // power-fit windows offered, seconds
+  static const unsigned char POWERFIT_STEP=4;
+  static const unsigned char POWERFIT_MAX=20;
 };
 
 
@@ -11,45 +11,275 @@ LEDDriver::LEDDriver(unsigned char p_e_center_hard, unsigned char p_e_center_sof
     begin();
 }  
 
-void LEDDriver::begin() {
+void LEDDriver::begin(bool highres) {
+    linear[0]=EEPROM.read(tableAddr(false)) == MAGIC;
+    linear[1]=EEPROM.read(tableAddr(true)) == MAGIC;
+
+    // Pins idle high (off) with their compare units disconnected; switching
+    // then only has to connect or disconnect them, not go through
+    // analogWrite's per-call pin lookup.
+    const char pins[CHANNELS] = { pin_expose_center_hard, pin_expose_center_soft,
+                                  pin_expose_corner_hard, pin_expose_corner_soft };
+    groups = 0;
+    for (unsigned char c = 0; c < CHANNELS; ++c) {
+        volatile uint8_t *tccr = NULL;
+        uint8_t com = 0;
+        unsigned char timer = digitalPinToTimer(pins[c]);
+        switch (timer) {
+        case TIMER1A: tccr = &TCCR1A; com = _BV(COM1A1); break;
+        case TIMER1B: tccr = &TCCR1A; com = _BV(COM1B1); break;
+        case TIMER1C: tccr = &TCCR1A; com = _BV(COM1C1); break;
+        case TIMER2A: tccr = &TCCR2A; com = _BV(COM2A1); break;
+        case TIMER2B: tccr = &TCCR2A; com = _BV(COM2B1); break;
+        case TIMER3A: tccr = &TCCR3A; com = _BV(COM3A1); break;
+        case TIMER3B: tccr = &TCCR3A; com = _BV(COM3B1); break;
+        case TIMER3C: tccr = &TCCR3A; com = _BV(COM3C1); break;
+        case TIMER4A: tccr = &TCCR4A; com = _BV(COM4A1); break;
+        case TIMER4B: tccr = &TCCR4A; com = _BV(COM4B1); break;
+        case TIMER4C: tccr = &TCCR4A; com = _BV(COM4C1); break;
+        default: timer = NOT_ON_TIMER;
+        }
+
+        unsigned char g = 0;
+        while (g < groups && grouptccr[g] != tccr) ++g;
+        if (g == groups) {
+            grouptccr[g] = tccr;
+            groupcom[g] = 0;
+            grouptimer[g] = timer;
+            ++groups;
+        }
+        groupcom[g] |= com;
+        outputs[c].timer = timer;
+        outputs[c].group = g;
+        outputs[c].com = com;
+
+        digitalWrite(pins[c], HIGH);
+        pinMode(pins[c], OUTPUT);
+    }
+
+    // high resolution needs every channel on a 16-bit timer
+    hires = highres;
+    for (unsigned char g = 0; g < groups; ++g) {
+        if (grouptccr[g] == NULL || grouptccr[g] == &TCCR2A) hires = false;
+    }
+    if (hires) {
+        for (unsigned char g = 0; g < groups; ++g) setHighRes(grouptimer[g]);
+    }
+
+    relayport = portOutputRegister(digitalPinToPort(pin_safelight_relay));
+    relaybit = digitalPinToBitMask(pin_safelight_relay);
     pinMode(pin_safelight_relay, OUTPUT);
     allOff();
 }
 
-void LEDDriver::focusOn(unsigned char center_hard, unsigned char center_soft, unsigned char corner_hard, unsigned char corner_soft) {
+void LEDDriver::focusOn(unsigned int center_hard, unsigned int center_soft, unsigned int corner_hard, unsigned int corner_soft) {
     // analogWrite(pin_expose_center_soft, LED_SOFT_MAX);
     // analogWrite(pin_expose_corner_soft, LED_SOFT_MAX);
     // digitalWrite(pin_safelight_relay, HIGH);
     exposeOn(center_hard, center_soft, corner_hard, corner_soft);
 }
 
-void LEDDriver::exposeOn(unsigned char center_hard, unsigned char center_soft, unsigned char corner_hard, unsigned char corner_soft) {
+void LEDDriver::exposeOn(unsigned int center_hard, unsigned int center_soft, unsigned int corner_hard, unsigned int corner_soft) {
     //For Percents
     // analogWrite(pin_expose_center_hard, LED_HARD_MIN - (constrain(corner_hard, 0, 100) * ((LED_HARD_MIN - LED_HARD_MAX) / 100.0)));
     // analogWrite(pin_expose_center_soft, LED_SOFT_MIN - (constrain(corner_soft, 0, 100) * ((LED_SOFT_MIN - LED_SOFT_MAX) / 100.0)));
     // analogWrite(pin_expose_corner_hard, LED_HARD_MIN - (constrain(corner_hard, 0, 100) * ((LED_HARD_MIN - LED_HARD_MAX) / 100.0)));
     // analogWrite(pin_expose_corner_soft, LED_SOFT_MIN - (constrain(corner_soft, 0, 100) * ((LED_SOFT_MIN - LED_SOFT_MAX) / 100.0)));
 
-    //For absolute values
-    if (center_hard != LED_OFF) analogWrite(pin_expose_center_hard, constrain(center_hard, LED_HARD_MAX, LED_HARD_MIN));
-    if (center_soft != LED_OFF) analogWrite(pin_expose_center_soft, constrain(center_soft, LED_SOFT_MAX, LED_SOFT_MIN));
-    if (corner_hard != LED_OFF) analogWrite(pin_expose_corner_hard, constrain(corner_hard, LED_HARD_MAX, LED_HARD_MIN));
-    if (corner_soft != LED_OFF) analogWrite(pin_expose_corner_soft, constrain(corner_soft, LED_SOFT_MAX, LED_SOFT_MIN));
-    digitalWrite(pin_safelight_relay, HIGH);
+    //For linear fine powers
+    const unsigned int pwm[CHANNELS] = { toPWM(true, center_hard), toPWM(false, center_soft),
+                                          toPWM(true, corner_hard), toPWM(false, corner_soft) };
+    switchTo(pwm, true);
 }
 
 void LEDDriver::calibrateOn(unsigned char center_hard, unsigned char center_soft, unsigned char corner_hard, unsigned char corner_soft) {
-    analogWrite(pin_expose_center_hard, center_hard);
-    analogWrite(pin_expose_center_soft, center_soft);
-    analogWrite(pin_expose_corner_hard, corner_hard);
-    analogWrite(pin_expose_corner_soft, corner_soft);
-    digitalWrite(pin_safelight_relay, HIGH);
+    const unsigned int pwm[CHANNELS] = { toFine(center_hard), toFine(center_soft), toFine(corner_hard), toFine(corner_soft) };
+    switchTo(pwm, true);
+}
+
+void LEDDriver::switchTo(const unsigned int *pwm, bool relay) {
+    uint8_t com[CHANNELS];
+    for (unsigned char g = 0; g < groups; ++g) com[g] = 0;
+    bool any = false;
+
+    // Compare values first, while the pins may still be disconnected.
+    for (unsigned char c = 0; c < CHANNELS; ++c) {
+        if (pwm[c] >= FINE_OFF || outputs[c].timer == NOT_ON_TIMER) continue;
+        if (hires) setCompare(outputs[c].timer, ((unsigned long)pwm[c] * HIRES_TOP + FINE_OFF/2) / FINE_OFF);
+        else setCompare(outputs[c].timer, (pwm[c] + (1 << (FINEBITS-1))) >> FINEBITS);
+        com[outputs[c].group] |= outputs[c].com;
+        any = true;
+    }
+
+    // Only the PWM timers in use are stopped; Timer0 (millis) and Timer5
+    // (the exposure clock) share the synchronous prescaler, so that is
+    // never halted or reset.
+    uint8_t used = 0;
+    if (any) {
+        for (unsigned char g = 0; g < groups; ++g) {
+            switch (grouptimer[g]) {
+            case TIMER1A: case TIMER1B: case TIMER1C: used |= _BV(1); break;
+            case TIMER2A: case TIMER2B: used |= _BV(2); break;
+            case TIMER3A: case TIMER3B: case TIMER3C: used |= _BV(3); break;
+            case TIMER4A: case TIMER4B: case TIMER4C: used |= _BV(4); break;
+            }
+        }
+    }
+
+    uint8_t oldSREG = SREG;
+    cli();
+    // Stop their clocks and zero the counters so every channel's PWM cycle
+    // starts together, within a few clocks of each other.
+    uint8_t cs1 = TCCR1B, cs2 = TCCR2B, cs3 = TCCR3B, cs4 = TCCR4B;
+    if (used & _BV(1)) { TCCR1B = cs1 & ~CS_MASK; TCNT1 = 0; }
+    if (used & _BV(2)) { TCCR2B = cs2 & ~CS_MASK; TCNT2 = 0; }
+    if (used & _BV(3)) { TCCR3B = cs3 & ~CS_MASK; TCNT3 = 0; }
+    if (used & _BV(4)) { TCCR4B = cs4 & ~CS_MASK; TCNT4 = 0; }
+    for (unsigned char g = 0; g < groups; ++g) {
+        if (grouptccr[g] != NULL) *grouptccr[g] = (*grouptccr[g] & ~groupcom[g]) | com[g];
+    }
+    if (relay) *relayport |= relaybit;
+    else *relayport &= ~relaybit;
+    if (used & _BV(1)) TCCR1B = cs1;
+    if (used & _BV(2)) TCCR2B = cs2;
+    if (used & _BV(3)) TCCR3B = cs3;
+    if (used & _BV(4)) TCCR4B = cs4;
+    SREG = oldSREG;
+}
+
+void LEDDriver::zoneOff(bool corner) {
+    // Disconnecting a pin hands it back to its idle level; the counters
+    // are left alone so the other zone's current cycle is not cut short.
+    unsigned char first = corner ? 2 : 0;
+    uint8_t oldSREG = SREG;
+    cli();
+    for (unsigned char c = first; c < first + 2; ++c) {
+        if (outputs[c].timer == NOT_ON_TIMER) continue;
+        volatile uint8_t *tccr = grouptccr[outputs[c].group];
+        if (tccr != NULL) *tccr &= ~outputs[c].com;
+    }
+    SREG = oldSREG;
+}
+
+void LEDDriver::setCompare(unsigned char timer, unsigned int value) {
+    switch (timer) {
+    case TIMER1A: OCR1A = value; break;
+    case TIMER1B: OCR1B = value; break;
+    case TIMER1C: OCR1C = value; break;
+    case TIMER2A: OCR2A = value; break;
+    case TIMER2B: OCR2B = value; break;
+    case TIMER3A: OCR3A = value; break;
+    case TIMER3B: OCR3B = value; break;
+    case TIMER3C: OCR3C = value; break;
+    case TIMER4A: OCR4A = value; break;
+    case TIMER4B: OCR4B = value; break;
+    case TIMER4C: OCR4C = value; break;
+    }
+}
+
+void LEDDriver::setHighRes(unsigned char timer) {
+    switch (timer) {
+    case TIMER1A: case TIMER1B: case TIMER1C:
+        TCCR1A = _BV(WGM11);
+        TCCR1B = _BV(WGM13) | _BV(CS10);
+        ICR1 = HIRES_TOP;
+        break;
+    case TIMER3A: case TIMER3B: case TIMER3C:
+        TCCR3A = _BV(WGM31);
+        TCCR3B = _BV(WGM33) | _BV(CS30);
+        ICR3 = HIRES_TOP;
+        break;
+    case TIMER4A: case TIMER4B: case TIMER4C:
+        TCCR4A = _BV(WGM41);
+        TCCR4B = _BV(WGM43) | _BV(CS40);
+        ICR4 = HIRES_TOP;
+        break;
+    }
+}
+
+unsigned int LEDDriver::readTable(bool hard, unsigned char power) {
+    int addr = tableAddr(hard)+1+2*power;
+    return EEPROM.read(addr) | (EEPROM.read(addr+1) << 8);
+}
+
+unsigned int LEDDriver::toPWM(bool hard, unsigned int power) const {
+    unsigned int full = toFine(hard ? LED_HARD_MAX : LED_SOFT_MAX);
+    unsigned int dim = toFine(hard ? LED_HARD_MIN : LED_SOFT_MIN);
+    if (power >= FINE_OFF) return FINE_OFF;
+    if (linear[hard ? 1 : 0]) {
+        // part way between the entries for the levels either side
+        unsigned char level = toLevel(power);
+        unsigned int lo = readTable(hard, level);
+        unsigned int hi = level+1 < TABLELEN ? readTable(hard, level+1) : dim;
+        power = lo + (((unsigned long)(hi-lo) * (power & (toFine(1)-1))) >> FINEBITS);
+    }
+    return constrain(power, full, dim);
+}
+
+bool LEDDriver::setResponse(bool hard, const uint16_t *response) {
+    unsigned char full = hard ? LED_HARD_MAX : LED_SOFT_MAX;
+    unsigned char dim = hard ? LED_HARD_MIN : LED_SOFT_MIN;
+    long bright = response[full], dark = response[LED_OFF];
+    if (bright <= dark) return false;
+
+    int addr = tableAddr(hard);
+    EEPROM.write(addr++, 0);
+    linear[hard ? 1 : 0] = false;
+
+    // Light falls as the PWM value rises; noise can make it rise again,
+    // so walk a running minimum.  Targets fall with power level too, so
+    // one pass finds the step each level's target lies in, and where in
+    // it, for every level.
+    unsigned char pwm = full;
+    long at = bright, next = bright;
+    for (int power = 0; power < TABLELEN; ++power) {
+        int p = power < full ? full : power;
+        long target = dark + (bright-dark)*(LED_OFF-p)/(LED_OFF-full);
+        while (pwm < dim) {
+            next = min(at, (long)response[pwm+1]);
+            if (next < target) break;
+            ++pwm;
+            at = next;
+        }
+        unsigned int fine = toFine(pwm);
+        if (pwm < dim && at > next) fine += ((at-target) << FINEBITS) / (at-next);
+
+        if (EEPROM.read(addr) != (fine & 0xFF)) EEPROM.write(addr, fine & 0xFF);
+        if (EEPROM.read(addr+1) != (fine >> 8)) EEPROM.write(addr+1, fine >> 8);
+        addr += 2;
+    }
+
+    EEPROM.write(tableAddr(hard), MAGIC);
+    linear[hard ? 1 : 0] = true;
+    return true;
+}
+
+void LEDDriver::clearResponse(bool hard) {
+    EEPROM.write(tableAddr(hard), 0);
+    linear[hard ? 1 : 0] = false;
+}
+
+unsigned int LEDDriver::relativeOutput(bool hard, unsigned int power) {
+    if (power >= FINE_OFF) return 0;
+    unsigned int full = toFine(hard ? LED_HARD_MAX : LED_SOFT_MAX);
+    if (power < full) power = full;
+    return ((unsigned long)(FINE_OFF - power) * 1024) / (FINE_OFF - full);
+}
+
+unsigned int LEDDriver::relativePower(bool hard, unsigned int rel) {
+    if (rel == 0) return FINE_OFF;
+    if (rel > 1024) rel = 1024;
+    unsigned int full = toFine(hard ? LED_HARD_MAX : LED_SOFT_MAX);
+    return FINE_OFF - ((unsigned long)(FINE_OFF - full) * rel + 512) / 1024;
+}
+
+unsigned long LEDDriver::fullPowerTime(bool hard, unsigned int power, unsigned long us) {
+    unsigned int rel = relativeOutput(hard, power);
+    // split to stay within 32 bits for any us
+    return (us >> 10) * rel + (((us & 1023) * rel + 512) >> 10);
 }
 
 void LEDDriver::allOff() {
-    analogWrite(pin_expose_center_hard, LED_OFF);
-    analogWrite(pin_expose_center_soft, LED_OFF);
-    analogWrite(pin_expose_corner_hard, LED_OFF);
-    analogWrite(pin_expose_corner_soft, LED_OFF);
-    digitalWrite(pin_safelight_relay, LOW);
-}
\ No newline at end of file
+    const unsigned int pwm[CHANNELS] = { FINE_OFF, FINE_OFF, FINE_OFF, FINE_OFF };
+    switchTo(pwm, false);
+}
@@ -2,11 +2,24 @@
 #define _LED_DRIVER_H_
 
 #include <Arduino.h>
+#include <EEPROM.h>
+#include "EEPROMLayout.h"
 
 class LEDDriver {
 public:
     LEDDriver(unsigned char p_e_center_hard, unsigned char p_e_center_soft, unsigned char p_e_corner_hard, unsigned char p_e_corner_soft, unsigned char p_e_safelight);
-    void begin();
+
+    /// resolve the exposure pins to their timers and switch everything off;
+    /// the exposure pins must be PWM outputs of Timer1..4 (Timer0 keeps
+    /// millis() and Timer5 is the ExposureTimer), others never light
+    /// @param highres run the PWM at 14 bits rather than 8; needs every
+    ///        exposure pin on a 16-bit timer, else it is ignored
+    void begin(bool highres=false);
+
+    /// PWM is running at high resolution
+    bool isHighRes() const {
+        return hires;
+    }
   
 /**
  * Scale the LEDS if you want to keep them from running at maximum current for longevity
@@ -16,7 +29,8 @@ public:
  * For maximum life of the LEDs we should run them around 70% of the max, so we will need to scale the soft LEDs back.
  * Testing indicates that 7 results in .72Amps, which is close enough
  * Both LEDs get a bit unstable at low currents. So a minimum brightness needs to be established. 200 is a good starting point
- * Both LEDs are non linear in output vs current over these ranges, so look into this if we add a dimming function.
+ * Both LEDs are non linear in output vs current over these ranges, so exposeOn() and focusOn() take a linear
+ * power level and map it through a per-type inverse response table built from calibrateLightSource() data.
  */
     static const unsigned char LED_HARD_MAX=0;
     static const unsigned char LED_HARD_MIN=200;
@@ -24,12 +38,112 @@ public:
     static const unsigned char LED_SOFT_MIN=200;
     static const unsigned char LED_OFF=255;
 
-    void focusOn(unsigned char center_hard, unsigned char center_soft, unsigned char corner_hard, unsigned char corner_soft);
-    void exposeOn(unsigned char center_hard, unsigned char center_soft, unsigned char corner_hard, unsigned char corner_soft);
+    /// Fine powers are the power levels above with FINEBITS of fraction,
+    /// so that curves interpolated between grades, the linearisation
+    /// tables and high-resolution PWM are not cut back to 256 steps.
+    static const unsigned char FINEBITS=8;
+    static const unsigned int FINE_OFF=(unsigned int)LED_OFF << FINEBITS;
+
+    static unsigned int toFine(unsigned char power) {
+        return (unsigned int)power << FINEBITS;
+    }
+
+    /// power level at or above a fine power
+    static unsigned char toLevel(unsigned int fine) {
+        return fine >> FINEBITS;
+    }
+
+    /// light output at a fine power relative to full, in 1/1024ths;
+    /// exact for a linearised LED type, otherwise only as good as the
+    /// assumption that output follows PWM on-time
+    static unsigned int relativeOutput(bool hard, unsigned int power);
+
+    /// fine power giving an output relative to full, in 1/1024ths;
+    /// the inverse of relativeOutput(), FINE_OFF for 0
+    static unsigned int relativePower(bool hard, unsigned int rel);
+
+    /// time at full power delivering the same light as us at a fine power
+    static unsigned long fullPowerTime(bool hard, unsigned int power, unsigned long us);
+
+    /// switch on at fine powers; FINE_OFF leaves a channel dark
+    void focusOn(unsigned int center_hard, unsigned int center_soft, unsigned int corner_hard, unsigned int corner_soft);
+    void exposeOn(unsigned int center_hard, unsigned int center_soft, unsigned int corner_hard, unsigned int corner_soft);
+    /// switch on at raw 8-bit PWM values, bypassing linearisation and limits
     void calibrateOn(unsigned char center_hard, unsigned char center_soft, unsigned char corner_hard, unsigned char corner_soft);
     void allOff();
-  
+    /// switch one zone's channels off, leaving the other's PWM running
+    /// undisturbed; safe from an ISR
+    void zoneOff(bool corner);
+
+    /// build and store the table mapping linear power to PWM for one LED type
+    /// @param response light measured at each PWM value 0..255, as recorded
+    ///        by FstopTimer::calibrateLightSource()
+    /// @return false (table unchanged) if full power is no brighter than off
+    bool setResponse(bool hard, const uint16_t *response);
+
+    /// forget a table so that LED type is driven by raw PWM again
+    void clearResponse(bool hard);
+
+    /// a table is in use for this LED type
+    bool isLinear(bool hard) const {
+        return linear[hard ? 1 : 0];
+    }
+
 private:
+    /// PWM value, with FINEBITS of fraction, giving a fine power; clamped
+    /// to the usable range
+    unsigned int toPWM(bool hard, unsigned int power) const;
+
+    /// high-resolution PWM period: 14 bits at clk/1 keeps the 490Hz of
+    /// the 8-bit default, which full 16 bits would cut to 122Hz
+    static const unsigned int HIRES_TOP=16383;
+
+    /// clock select bits, CSn2..CSn0, of every TCCRnB
+    static const uint8_t CS_MASK=0x07;
+
+    /// put a 16-bit timer into phase-correct PWM with HIRES_TOP
+    static void setHighRes(unsigned char timer);
+
+    /// channels in argument order, as LampModel
+    static const unsigned char CHANNELS=4;
+
+    /// PWM values with FINEBITS of fraction for all four channels,
+    /// FINE_OFF to leave one dark, and the relay; everything changes
+    /// inside one short critical section
+    void switchTo(const unsigned int *pwm, bool relay);
+
+    /// OCRnx for an Arduino TIMERnx code
+    static void setCompare(unsigned char timer, unsigned int value);
+
+    /// one PWM channel as resolved by begin(); channels sharing a timer
+    /// share a group, whose COM bits are changed in a single write
+    struct Output {
+        unsigned char timer;      ///< Arduino TIMERnx code
+        unsigned char group;      ///< index into grouptccr
+        uint8_t com;              ///< COMnx1 bit connecting the pin to its compare unit
+    };
+    Output outputs[CHANNELS];
+    unsigned char groups;
+    volatile uint8_t *grouptccr[CHANNELS];
+    uint8_t groupcom[CHANNELS];
+    unsigned char grouptimer[CHANNELS];
+    volatile uint8_t *relayport;
+    uint8_t relaybit;
+    bool hires;
+
+    /// one PWM value (with FINEBITS of fraction, LSB first) per power
+    /// level below LED_OFF, after a magic byte
+    static const unsigned char TABLELEN=LED_OFF;
+    static const unsigned char MAGIC=0x5D;
+
+    static int tableAddr(bool hard) {
+        return EE_LINEAR + (hard ? 1+2*TABLELEN : 0);
+    }
+
+    static unsigned int readTable(bool hard, unsigned char power);
+
+    bool linear[2];
+
     char pin_expose_center_hard;
     char pin_expose_center_soft;
     char pin_expose_corner_hard;
@@ -0,0 +1,100 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "LampModel.h"
+#include "LEDDriver.h"
+
+LampModel::LampModel()
+{
+    generation=0;
+    clear();
+}
+
+void LampModel::clear()
+{
+    for(unsigned char c=0;c<CHANNELS;++c)
+        for(unsigned char p=0;p<POINTS;++p)
+            offsets[c][p]=0;
+    valid=false;
+    ++generation;
+}
+
+void LampModel::load()
+{
+    clear();
+    int addr=EE_LAMPCOMP;
+    if(EEPROM.read(addr++) != MAGIC)
+        return;
+
+    for(unsigned char c=0;c<CHANNELS;++c){
+        for(unsigned char p=0;p<POINTS;++p){
+            int tmp=EEPROM.read(addr++) << 8;
+            tmp|=EEPROM.read(addr++);
+            offsets[c][p]=tmp;
+        }
+    }
+    valid=true;
+}
+
+void LampModel::save()
+{
+    int addr=EE_LAMPCOMP;
+    EEPROM.write(addr++, MAGIC);
+    for(unsigned char c=0;c<CHANNELS;++c){
+        for(unsigned char p=0;p<POINTS;++p){
+            EEPROM.write(addr++, (offsets[c][p] >> 8) & 0xFF);
+            EEPROM.write(addr++, offsets[c][p] & 0xFF);
+        }
+    }
+    valid=true;
+}
+
+void LampModel::setOffset(unsigned char channel, unsigned char point, int us)
+{
+    if(channel >= CHANNELS || point >= POINTS)
+        return;
+    offsets[channel][point]=us;
+    ++generation;
+}
+
+int LampModel::getOffset(unsigned char channel, unsigned char power) const
+{
+    if(channel >= CHANNELS || power == LEDDriver::LED_OFF)
+        return 0;
+
+    unsigned char p=power/POWERSTEP;
+    if(p >= POINTS-1)
+        return offsets[channel][POINTS-1];
+
+    // linear between breakpoints
+    int lo=offsets[channel][p], hi=offsets[channel][p+1];
+    return lo+(long)(hi-lo)*(power-p*POWERSTEP)/POWERSTEP;
+}
+
+int LampModel::getZoneOffset(bool corner, unsigned int hard, unsigned int soft) const
+{
+    unsigned int rh=LEDDriver::relativeOutput(true, hard);
+    unsigned int rs=LEDDriver::relativeOutput(false, soft);
+    if(rh+rs == 0)
+        return 0;
+
+    // extra light of each channel over the zone's steady output
+    long sum=(long)rh*getOffset(corner ? CORNER_HARD : CENTER_HARD, LEDDriver::toLevel(hard))
+            +(long)rs*getOffset(corner ? CORNER_SOFT : CENTER_SOFT, LEDDriver::toLevel(soft));
+    return sum/(long)(rh+rs);
+}
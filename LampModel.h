@@ -0,0 +1,106 @@
+/* -*- C++ -*- */
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _LAMP_MODEL_H_
+#define _LAMP_MODEL_H_
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "EEPROMLayout.h"
+
+/**
+ * Switching-edge compensation for the four LED channels.
+ *
+ * For each channel and a set of power breakpoints we hold the light
+ * delivered by one on/off cycle beyond what steady-state output for
+ * the commanded time would give, expressed as microseconds of
+ * steady-state output.  Positive means the lamp over-delivers (the
+ * fall tail outweighs the rise lag) so the exposure must be shortened.
+ *
+ * The TSL2561 integrates over at least 13ms so the rise and fall
+ * edges cannot be seen separately; only their net effect per cycle is
+ * measured, which is all that compensation needs.
+ *
+ * Measured by FstopTimer::calibrateLampLag(), persisted at EE_LAMPCOMP.
+ */
+class LampModel {
+public:
+
+    /// channels in LEDDriver argument order
+    enum {
+        CENTER_HARD,
+        CENTER_SOFT,
+        CORNER_HARD,
+        CORNER_SOFT,
+        CHANNELS
+    };
+
+    /// power breakpoints 0, 25 .. 200 (LED_HARD_MIN/LED_SOFT_MIN)
+    static const unsigned char POINTS=9;
+    static const unsigned char POWERSTEP=25;
+
+    LampModel();
+
+    /// forget all offsets
+    void clear();
+
+    /// read offsets from EEPROM; cleared if never calibrated
+    void load();
+
+    /// write offsets to EEPROM and mark valid
+    void save();
+
+    bool isValid() const {
+        return valid;
+    }
+
+    /// changes whenever any offset does
+    unsigned int getGeneration() const {
+        return generation;
+    }
+
+    /// LEDDriver power at a breakpoint
+    static unsigned char pointPower(unsigned char point) {
+        return point*POWERSTEP;
+    }
+
+    /// @param channel CENTER_HARD..CORNER_SOFT
+    /// @param point breakpoint 0..POINTS-1
+    /// @param us net per-cycle offset in microseconds
+    void setOffset(unsigned char channel, unsigned char point, int us);
+
+    /// per-cycle offset at any power, interpolated between breakpoints
+    /// @return microseconds; 0 for an off channel
+    int getOffset(unsigned char channel, unsigned char power) const;
+
+    /// per-cycle offset of one zone at the given fine powers: its two
+    /// channels' offsets weighted by their relative output, so an off
+    /// channel counts for nothing
+    int getZoneOffset(bool corner, unsigned int hard, unsigned int soft) const;
+
+private:
+
+    static const unsigned char MAGIC=0xA5;
+
+    int offsets[CHANNELS][POINTS];
+    bool valid;
+    unsigned int generation;
+};
+
+#endif // _LAMP_MODEL_H_
@@ -0,0 +1,92 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "LightSensor.h"
+
+LightSensor::LightSensor(TSL2561 &t)
+    : tsl(t)
+{
+    busy=false;
+    continuous=false;
+    full=ir=0;
+    stamp=0;
+    count=0;
+}
+
+unsigned long LightSensor::windowUs(tsl2561IntegrationTime_t timing)
+{
+    // nominal 13.7, 101 and 402ms, with room for the sensor's own
+    // oscillator running slow; an early read returns the old window
+    switch(timing){
+    case TSL2561_INTEGRATIONTIME_13MS:
+        return 15000;
+    case TSL2561_INTEGRATIONTIME_101MS:
+        return 120000;
+    default:
+        return 450000;
+    }
+}
+
+void LightSensor::start(tsl2561Gain_t gain, tsl2561IntegrationTime_t timing, bool c)
+{
+    // the library's setters leave the sensor powered down, and powering
+    // up restarts integration, so the window starts here
+    tsl.setGain(gain);
+    tsl.setTiming(timing);
+    tsl.enable();
+    started=micros();
+    period=windowUs(timing);
+    continuous=c;
+    busy=true;
+}
+
+bool LightSensor::poll()
+{
+    if(!busy)
+        return false;
+    unsigned long now=micros();
+    if(now-started < period)
+        return false;
+
+    full=tsl.read16(TSL2561_COMMAND_BIT | TSL2561_WORD_BIT | TSL2561_REGISTER_CHAN0_LOW);
+    ir=tsl.read16(TSL2561_COMMAND_BIT | TSL2561_WORD_BIT | TSL2561_REGISTER_CHAN1_LOW);
+    stamp=millis();
+    ++count;
+
+    if(continuous){
+        // windows missed while nobody polled are simply skipped
+        while(now-started >= period)
+            started+=period;
+    }
+    else
+        stop();
+    return true;
+}
+
+void LightSensor::wait()
+{
+    while(busy && !continuous)
+        poll();
+}
+
+void LightSensor::stop()
+{
+    tsl.disable();
+    busy=false;
+}
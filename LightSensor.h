@@ -0,0 +1,102 @@
+/* -*- C++ -*- */
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _LIGHT_SENSOR_H_
+#define _LIGHT_SENSOR_H_
+
+#include <Arduino.h>
+#include "TSL2561.h"
+
+/**
+ * Acquisition task for the TSL2561, so that nothing waits on an
+ * integration.
+ *
+ * start() powers the sensor up, which begins a window, and returns at
+ * once; poll(), called from FstopTimer::poll() and by anything else
+ * that is waiting, reads both channels once the window must be over.
+ * The latest reading is cached with the time it was collected and a
+ * count, so several users can share it and tell a fresh reading from
+ * one they have seen.  In continuous mode the sensor keeps integrating
+ * and each window is collected in turn until stop().
+ *
+ * Whoever calls start() owns the sensor until the next start(); the
+ * settings it asked for are applied every time.
+ */
+class LightSensor {
+public:
+
+    LightSensor(TSL2561 &t);
+
+    /// begin a window, abandoning any acquisition in progress
+    /// @param continuous keep integrating until stop()
+    void start(tsl2561Gain_t gain, tsl2561IntegrationTime_t timing, bool continuous=false);
+
+    /// collect a finished window if there is one
+    /// @return true if a new reading was cached
+    bool poll();
+
+    /// poll until a one-shot acquisition is in; for calibration only
+    void wait();
+
+    /// power down, abandoning any acquisition
+    void stop();
+
+    /// a window is being integrated
+    bool isBusy() const {
+        return busy;
+    }
+
+    /// latest full-spectrum (channel 0) counts
+    uint16_t getFull() const {
+        return full;
+    }
+
+    /// latest infrared (channel 1) counts
+    uint16_t getIR() const {
+        return ir;
+    }
+
+    /// millis() when the latest reading was collected
+    unsigned long getTime() const {
+        return stamp;
+    }
+
+    /// readings collected so far, wrapping; changes with each new one
+    unsigned char getCount() const {
+        return count;
+    }
+
+    /// time to allow for one window, us
+    static unsigned long windowUs(tsl2561IntegrationTime_t timing);
+
+private:
+
+    TSL2561 &tsl;
+
+    bool busy;
+    bool continuous;
+    unsigned long started;   ///< micros() at the start of the window
+    unsigned long period;
+
+    uint16_t full, ir;
+    unsigned long stamp;
+    unsigned char count;
+};
+
+#endif // _LIGHT_SENSOR_H_
@@ -0,0 +1,169 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "LightSweep.h"
+
+/**
+ * Sensor settings, least sensitive first: 13.7ms at 1x, 13.7ms at 16x,
+ * 101ms at 16x, 402ms at 16x.  101ms at 1x is skipped; it is slower than
+ * 13.7ms at 16x for less signal.  Scales to 402ms at 16x are in 1/1024ths,
+ * from the TSL2561 datasheet (0x7517 and 0x0FE7), and saturation is 90%
+ * of each window's full count.
+ */
+static const unsigned long SWEEPSCALE[4] PROGMEM={ 16UL*0x7517, 0x7517, 0x0FE7, 0x0400 };
+static const unsigned int SWEEPSAT[4] PROGMEM={ 4540, 4540, 33460, 58980 };
+
+LightSweep::LightSweep(LightSensor &s, LEDDriver &led)
+    : sensor(s), leddriver(led)
+{
+    points=0;
+    setting=0;
+    shift=0;
+    error=0;
+}
+
+void LightSweep::measure(unsigned char pwm, unsigned long &full, unsigned long &ir)
+{
+    if(hard)
+        leddriver.calibrateOn(pwm, LEDDriver::LED_OFF, pwm, LEDDriver::LED_OFF);
+    else
+        leddriver.calibrateOn(LEDDriver::LED_OFF, pwm, LEDDriver::LED_OFF, pwm);
+
+    uint16_t ch0=0, ch1=0;
+    for(unsigned char tries=0;tries < 2*SETTINGS;++tries){
+        // a fresh window each time, so it sees only this level
+        sensor.start(setting == 0 ? TSL2561_GAIN_0X : TSL2561_GAIN_16X,
+                     setting < 2 ? TSL2561_INTEGRATIONTIME_13MS
+                     : setting == 2 ? TSL2561_INTEGRATIONTIME_101MS : TSL2561_INTEGRATIONTIME_402MS);
+        sensor.wait();
+        ch0=sensor.getFull();
+        ch1=sensor.getIR();
+
+        if(ch0 > pgm_read_word(&SWEEPSAT[setting]) && setting > 0){
+            --setting;
+        }
+        else if(ch0 < MINCOUNTS && setting < SETTINGS-1
+                && ((unsigned long)ch0*pgm_read_dword(&SWEEPSCALE[setting]))/pgm_read_dword(&SWEEPSCALE[setting+1])
+                   < pgm_read_word(&SWEEPSAT[setting+1])){
+            // the next setting has room for this much light
+            ++setting;
+        }
+        else
+            break;
+    }
+
+    unsigned long scale=pgm_read_dword(&SWEEPSCALE[setting]);
+    full=((unsigned long)ch0*scale) >> 10;
+    ir=((unsigned long)ch1*scale) >> 10;
+}
+
+unsigned char LightSweep::insert(unsigned char pwm)
+{
+    unsigned char i=points;
+    while(i > 0 && pts[i-1].pwm > pwm){
+        pts[i]=pts[i-1];
+        --i;
+    }
+    measure(pwm, pts[i].full, pts[i].ir);
+    pts[i].pwm=pwm;
+    pts[i].miss=UNCHECKED;
+    ++points;
+    return i;
+}
+
+unsigned long LightSweep::interpolate(unsigned long v0, unsigned long v1,
+                                      unsigned char p0, unsigned char p1, unsigned char pwm)
+{
+    if(p1 == p0)
+        return v0;
+    // readings stay under 2.4M, so the product fits in 32 bits
+    return v0+((long)v1-(long)v0)*(pwm-p0)/(p1-p0);
+}
+
+void LightSweep::run(bool h)
+{
+    hard=h;
+    points=0;
+    error=0;
+    setting=0;
+
+    // coarse grid, brightest first so the setting only ever gets more sensitive
+    for(int pwm=0;pwm <= LEDDriver::LED_OFF;pwm+=GRID)
+        insert(pwm);
+    if(pts[points-1].pwm != LEDDriver::LED_OFF)
+        insert(LEDDriver::LED_OFF);
+
+    unsigned long lo=pts[0].full, hi=pts[0].full;
+    for(unsigned char i=1;i<points;++i){
+        lo=min(lo, pts[i].full);
+        hi=max(hi, pts[i].full);
+    }
+    unsigned long permille=max((hi-lo)/1000, 1UL);
+
+    // bisect the first interval still open until none is or the budget is spent
+    unsigned int worstopen=0;
+    while(points < MAXPOINTS){
+        unsigned char i=0;
+        while(i+1 < points && (pts[i].miss != UNCHECKED || pts[i+1].pwm-pts[i].pwm < 2))
+            ++i;
+        if(i+1 >= points)
+            break;
+
+        unsigned char p0=pts[i].pwm, p1=pts[i+1].pwm;
+        unsigned long expect=interpolate(pts[i].full, pts[i+1].full, p0, p1, (p0+p1)/2);
+        unsigned char m=insert((p0+p1)/2);
+        unsigned long got=pts[m].full;
+        unsigned long dev=(got > expect ? got-expect : expect-got)/permille;
+        unsigned int miss=min(dev, (unsigned long)UNCHECKED-1);
+
+        if(miss <= TOLERANCE){
+            pts[i].miss=miss;
+            pts[m].miss=miss;
+        }
+        else
+            worstopen=max(worstopen, miss);
+    }
+
+    bool open=false;
+    for(unsigned char i=0;i+1 < points;++i){
+        if(pts[i].miss != UNCHECKED)
+            error=max(error, pts[i].miss);
+        else if(pts[i+1].pwm-pts[i].pwm > 1)
+            open=true;
+    }
+    if(open)
+        error=max(error, worstopen);
+
+    unsigned long top=0;
+    for(unsigned char i=0;i<points;++i)
+        top=max(top, max(pts[i].full, pts[i].ir));
+    for(shift=0;(top >> shift) > 0xFFFF;++shift)
+        ;
+
+    leddriver.allOff();
+}
+
+void LightSweep::get(unsigned char pwm, uint16_t &full, uint16_t &ir) const
+{
+    unsigned char i=0;
+    while(i+2 < points && pts[i+1].pwm < pwm)
+        ++i;
+    const Point &a=pts[i], &b=pts[i+1];
+    full=interpolate(a.full, b.full, a.pwm, b.pwm, pwm) >> shift;
+    ir=interpolate(a.ir, b.ir, a.pwm, b.pwm, pwm) >> shift;
+}
@@ -0,0 +1,108 @@
+/* -*- C++ -*- */
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _LIGHT_SWEEP_H_
+#define _LIGHT_SWEEP_H_
+
+#include <Arduino.h>
+#include "LightSensor.h"
+#include "LEDDriver.h"
+
+/**
+ * Adaptive measurement of one LED type's response over all 256 raw PWM
+ * values, for FstopTimer::calibrateLightSource().
+ *
+ * A coarse grid is measured first, then each interval is bisected: the
+ * midpoint is measured and if straight-line interpolation between the
+ * ends had it within TOLERANCE the interval is settled, otherwise both
+ * halves are checked in turn.  Smooth stretches of the curve thus cost
+ * a handful of readings and only bends are sampled densely; values in
+ * between are interpolated.  The worst miss seen at a settled midpoint
+ * is reported as the error estimate.
+ *
+ * Each reading uses the fastest sensor setting that neither saturates
+ * nor leaves too few counts, starting from the one the previous reading
+ * settled on, and is scaled to 402ms at 16x so all readings compare.
+ */
+class LightSweep {
+public:
+
+    LightSweep(LightSensor &s, LEDDriver &led);
+
+    /// measure one LED type, both zones together; leaves the LEDs off and
+    /// the sensor powered down
+    void run(bool hard);
+
+    /// response at a PWM value, measured or interpolated, in units that
+    /// fit 16 bits for the brightest reading of the sweep
+    void get(unsigned char pwm, uint16_t &full, uint16_t &ir) const;
+
+    /// readings taken by the last run()
+    unsigned char getPoints() const {
+        return points;
+    }
+
+    /// worst interpolation miss seen, in 1/1000 of the full-scale response;
+    /// includes intervals left open if the point budget ran out
+    unsigned int getError() const {
+        return error;
+    }
+
+private:
+
+    /// budget of readings per sweep
+    static const unsigned char MAXPOINTS=64;
+    /// coarse grid spacing in PWM values
+    static const unsigned char GRID=16;
+    /// settle an interval when its midpoint is this close, 1/1000 of full scale
+    static const unsigned int TOLERANCE=5;
+    /// fewest channel-0 counts worth keeping before trying a slower setting
+    static const unsigned int MINCOUNTS=500;
+    /// sensor settings from least to most sensitive
+    static const unsigned char SETTINGS=4;
+    /// interval not yet checked at its midpoint
+    static const unsigned int UNCHECKED=0xFFFF;
+
+    struct Point {
+        unsigned char pwm;
+        unsigned long full, ir;   ///< at 402ms, 16x
+        unsigned int miss;        ///< of the interval to the next point
+    };
+
+    /// read both channels with the LEDs at pwm, adapting the sensor setting
+    void measure(unsigned char pwm, unsigned long &full, unsigned long &ir);
+    /// measure at pwm and insert the reading, keeping pwm ascending
+    /// @return its index
+    unsigned char insert(unsigned char pwm);
+    /// straight line through (p0, v0) and (p1, v1)
+    static unsigned long interpolate(unsigned long v0, unsigned long v1,
+                                     unsigned char p0, unsigned char p1, unsigned char pwm);
+
+    LightSensor &sensor;
+    LEDDriver &leddriver;
+    bool hard;
+
+    Point pts[MAXPOINTS];
+    unsigned char points;
+    unsigned char setting;
+    unsigned char shift;        ///< right shift bringing the sweep into 16 bits
+    unsigned int error;
+};
+
+#endif // _LIGHT_SWEEP_H_
@@ -17,109 +17,276 @@
 */
 
 #include "Paper.h"
+#include "TextReader.h"
+#include "LEDDriver.h"
 
 Paper::Paper() {
-    sdready = false;
+    srcsize = 0;
+    generation = 0;
 }
 
-void Paper::init(bool ready)
+void Paper::init()
 {
-    sdready = ready;
-    if (sdready) {
-        load(0);
-    }
-    else {
-        initDefault();
-    }
+    initDefault();
 }
 
-bool Paper::load(char paper) {
-    if (!sdready) {
+bool Paper::load(const char *path) {
+    File f = SD.open(path, FILE_READ);
+    if (!f) {
         initDefault();
         return false;
     }
 
-    if(paper < FIRSTPAPER || paper > LASTPAPER)
-        return false;
-
-    String fileName = "/papers/";
-    fileName += (int) paper;
-    fileName += ".ppr";
-
-    char buf[30];
-    fileName.toCharArray(buf, 30);
-
-    File f = SD.open(buf, FILE_READ);
-        if (f) {
-        initFromFile(f);
-        f.close();
-        return true;
+    // .ppb is a precompiled image, anything else .ppr text
+    int len = strlen(path);
+    bool image = len > 4 && toupper(path[len-1]) == 'B';
+    bool ok = true;
+    if (image) {
+        ok = initFromImage(f, 0);
     }
     else {
-        initDefault();
+        initFromFile(f);
+        srcsize = f.size();
     }
-    return false;
+    f.close();
+
+    if (!ok)
+        initDefault();
+    return ok;
 }
 
 bool Paper::initFromFile(File& dataFile) {
+    ++generation;
+    TextReader in(dataFile);
+    int soft, hard;
+
     //Line 1: name
-    if (dataFile.available()) {
-        name = readLine(dataFile);
-    }
-    String line;
+    in.readText(name, NAMELEN+1);
+
     //Line 2: Max/focus brightness
-    line = readLine(dataFile);
-    int delim = line.indexOf(',');
-    maxBrightnessSoft = parseLevel(line.substring(0, delim));
-    maxBrightnessHard = parseLevel(line.substring(delim + 1));
+    in.readInt(soft);
+    in.readInt(hard);
+    in.nextLine();
+    maxBrightnessSoft = soft;
+    maxBrightnessHard = hard;
     
     //Line 3: Min Grade
-    minGrade = parseLevel(readLine(dataFile));
+    in.readInt(soft);
+    in.nextLine();
+    minGrade = soft;
     //Line 4: Max Grade
-    maxGrade = parseLevel(readLine(dataFile));
-
-    //Line 5+: Brightness pairs
-    for (int pos = 0; pos < GRADES; pos++) {
-        line = readLine(dataFile);
+    in.readInt(soft);
+    in.nextLine();
+    maxGrade = soft;
 
-        int delim = line.indexOf(',');
-        amountsSoft[pos] = parseLevel(line.substring(0, delim));
-        amountsHard[pos] = parseLevel(line.substring(delim + 1));
+    //Line 5+: "soft, hard" pairs for grades 30, 35 ..,
+    //or "grade, soft, hard" at any ascending grades
+    unsigned char grades[GRADES], amountsSoft[GRADES], amountsHard[GRADES];
+    unsigned char n = 0;
+    for (int row = 0; n < GRADES && !in.atEnd(); row++) {
+        int grade, third;
+        bool two = in.readInt(soft) && in.readInt(hard);
+        bool three = two && in.readInt(third);
+        in.nextLine();
+        if (!two)
+            continue;
+        if (three) {
+            grade = soft;
+            soft = hard;
+            hard = third;
+        }
+        else {
+            grade = MINGRADE + 5 * row;
+        }
+        if (grade < MINGRADE || grade > MAXGRADE || (n > 0 && grade <= grades[n-1]))
+            continue;
+        grades[n] = grade;
+        amountsSoft[n] = soft;
+        amountsHard[n] = hard;
+        n++;
     }
+    setCurve(grades, amountsSoft, amountsHard, n);
     
     return true;
 }
 
-unsigned char Paper::parseLevel(String level) {
-    level.trim();
-    return level.toInt();
+unsigned char Paper::imageSum(const Image& img) {
+    const unsigned char *b = (const unsigned char *)&img;
+    unsigned char sum = 0;
+    for (unsigned int i = 0; i < sizeof(Image)-1; i++)
+        sum ^= b[i];
+    return sum;
 }
 
-String Paper::readLine(File& dataFile) {
-    String ln = "";
-    while (dataFile.available()) {
-        char character = dataFile.read();
-        if (character == '\n') {
-            return ln;
-        }
-        else {
-            ln = ln + character;
-        }
+bool Paper::initFromImage(File& dataFile, unsigned long size) {
+    Image img;
+    if (dataFile.read(&img, sizeof(Image)) != (int)sizeof(Image))
+        return false;
+    return fromImage(img, size);
+}
+
+bool Paper::fromImage(const Image& img, unsigned long size) {
+    if (img.magic[0] != 'P' || img.magic[1] != 'P' || img.magic[2] != 'B'
+        || img.version != FORMAT || img.sum != imageSum(img))
+        return false;
+
+    unsigned long built = 0;
+    for (char i = 3; i >= 0; i--)
+        built = (built << 8) | img.srcsize[(int)i];
+    if (size != 0 && built != size)
+        return false;
+
+    ++generation;
+    srcsize = built;
+    memcpy(name, img.name, NAMELEN);
+    name[NAMELEN] = '\0';
+    maxBrightnessSoft = img.maxBrightnessSoft;
+    maxBrightnessHard = img.maxBrightnessHard;
+    minGrade = img.minGrade;
+    maxGrade = img.maxGrade;
+    points = min(img.points, MAXPOINTS);
+    memcpy(pointGrade, img.pointGrade, MAXPOINTS);
+    memcpy(pointSoft, img.pointSoft, MAXPOINTS);
+    memcpy(pointHard, img.pointHard, MAXPOINTS);
+    return true;
+}
+
+void Paper::toImage(Image& img) const {
+    img.magic[0] = 'P';
+    img.magic[1] = 'P';
+    img.magic[2] = 'B';
+    img.version = FORMAT;
+    unsigned long size = srcsize;
+    for (char i = 0; i < 4; i++) {
+        img.srcsize[(int)i] = size & 0xFF;
+        size >>= 8;
     }
-    return ln;
+    strncpy(img.name, name, NAMELEN);
+    img.maxBrightnessSoft = maxBrightnessSoft;
+    img.maxBrightnessHard = maxBrightnessHard;
+    img.minGrade = minGrade;
+    img.maxGrade = maxGrade;
+    img.points = points;
+    memcpy(img.pointGrade, pointGrade, MAXPOINTS);
+    memcpy(img.pointSoft, pointSoft, MAXPOINTS);
+    memcpy(img.pointHard, pointHard, MAXPOINTS);
+    img.sum = imageSum(img);
 }
 
 unsigned char Paper::getAmountSoft(unsigned char grade) {
-    return amountsSoft[(constrain(grade, MINGRADE, MAXGRADE) - MINGRADE) / 5];
+    return evaluate(pointSoft, grade);
 }
 
 unsigned char Paper::getAmountHard(unsigned char grade){
-    return amountsHard[(constrain(grade, MINGRADE, MAXGRADE) - MINGRADE) / 5];
+    return evaluate(pointHard, grade);
+}
+
+unsigned int Paper::getFineSoft(unsigned char grade) {
+    return evaluateFine(pointSoft, grade);
+}
+
+unsigned int Paper::getFineHard(unsigned char grade) {
+    return evaluateFine(pointHard, grade);
+}
+
+unsigned char Paper::interpolate(unsigned char g0, unsigned char v0,
+                                 unsigned char g1, unsigned char v1,
+                                 unsigned char grade) {
+    // no level lies between off and on, so an off end is a step at
+    // the midpoint, lit at the midpoint itself
+    if (v0 == LEDDriver::LED_OFF || v1 == LEDDriver::LED_OFF) {
+        int d0 = grade - g0, d1 = g1 - grade;
+        if (d0 == d1)
+            return v0 == LEDDriver::LED_OFF ? v1 : v0;
+        return d0 < d1 ? v0 : v1;
+    }
+
+    // rounded to nearest, in integers
+    int span = g1 - g0;
+    int num = (v1 - v0) * (grade - g0) * 2;
+    num += num < 0 ? -span : span;
+    return v0 + num / (2 * span);
+}
+
+unsigned char Paper::evaluate(const unsigned char *amount, unsigned char grade) const {
+    if (0 == points)
+        return LEDDriver::LED_OFF;
+    if (grade <= pointGrade[0])
+        return amount[0];
+    for (unsigned char i = 1; i < points; i++) {
+        if (grade <= pointGrade[i])
+            return interpolate(pointGrade[i-1], amount[i-1], pointGrade[i], amount[i], grade);
+    }
+    return amount[points-1];
+}
+
+unsigned int Paper::evaluateFine(const unsigned char *amount, unsigned char grade) const {
+    if (0 == points)
+        return LEDDriver::FINE_OFF;
+    if (grade <= pointGrade[0])
+        return LEDDriver::toFine(amount[0]);
+    for (unsigned char i = 1; i < points; i++) {
+        if (grade <= pointGrade[i]) {
+            if (amount[i-1] == LEDDriver::LED_OFF || amount[i] == LEDDriver::LED_OFF)
+                return LEDDriver::toFine(interpolate(pointGrade[i-1], amount[i-1],
+                                                     pointGrade[i], amount[i], grade));
+            // rounded to the nearest fine step
+            long span = pointGrade[i] - pointGrade[i-1];
+            long num = (long)(amount[i] - amount[i-1]) * (grade - pointGrade[i-1]) * LEDDriver::toFine(1) * 2;
+            num += num < 0 ? -span : span;
+            return LEDDriver::toFine(amount[i-1]) + num / (2 * span);
+        }
+    }
+    return LEDDriver::toFine(amount[points-1]);
+}
+
+int Paper::spanError(const unsigned char *grade, const unsigned char *amount,
+                     unsigned char a, unsigned char b) {
+    int worst = 0;
+    for (unsigned char i = a+1; i < b; i++) {
+        unsigned char v = interpolate(grade[a], amount[a], grade[b], amount[b], grade[i]);
+        // a channel that is off must stay off
+        if (amount[i] == LEDDriver::LED_OFF && v != LEDDriver::LED_OFF)
+            return 255;
+        worst = max(worst, abs(v - amount[i]));
+    }
+    return worst;
 }
 
-String& Paper::getName() { return name; }
+void Paper::setCurve(const unsigned char *grade, const unsigned char *soft,
+                     const unsigned char *hard, unsigned char n) {
+    // loosen the fit only as far as MAXPOINTS needs
+    for (int tol = 1; ; tol++) {
+        points = 0;
+        unsigned char a = 0;
+        for (unsigned char b = 1; b <= n && points < MAXPOINTS; b++) {
+            if (b < n && spanError(grade, soft, a, b) <= tol
+                && spanError(grade, hard, a, b) <= tol)
+                continue;
+            // a..b-1 is as far as one segment reaches
+            pointGrade[points] = grade[a];
+            pointSoft[points] = soft[a];
+            pointHard[points] = hard[a];
+            points++;
+            a = b-1;
+            if (b == n && a > 0 && points < MAXPOINTS) {
+                pointGrade[points] = grade[a];
+                pointSoft[points] = soft[a];
+                pointHard[points] = hard[a];
+                points++;
+            }
+        }
+        if (n == 0 || pointGrade[points-1] == grade[n-1])
+            return;
+    }
+}
 
 void Paper::initDefault() {
+    ++generation;
+    srcsize = 0;
+    unsigned char grades[GRADES], amountsSoft[GRADES], amountsHard[GRADES];
+
+
     //Rough curve from first round of testing
     amountsSoft[0] = 255; //30
     amountsSoft[1] = 255; //35
@@ -165,8 +332,13 @@ void Paper::initDefault() {
     for (unsigned char i = 6 ; i < 30; i++) {
         amountsHard[i] = 217 - amountsSoft[i];
     }
+    for (unsigned char i = 0 ; i < GRADES; i++) {
+        grades[i] = MINGRADE + 5 * i;
+    }
+    // hard is only filled in from 60 up; 55 reads as the first point
+    setCurve(&grades[6], &amountsSoft[6], &amountsHard[6], GRADES - 6);
     
-    name = "System Default Paper";
+    strcpy(name, "System Default Paper");
     maxBrightnessSoft = 217;
     maxBrightnessHard = 217;
     minGrade = 55;
@@ -27,28 +27,96 @@ class Paper {
 public:    
     Paper();
 
+    /// characters of name kept; one LCD line
+    static const int NAMELEN = 20;
+
 private:
     // bounds of grade, 30 to 200 in steps of 5
     static const int MAXGRADE = 200;
     static const int MINGRADE = 30;
-    static const int FIRSTPAPER = 0;
-    static const int LASTPAPER = 9;
 
+    /// rows in the original 5-step table format
     static const int GRADES = ((MAXGRADE - MINGRADE) / 5) + 1; 
+    /// most control points kept per paper
+    static const unsigned char MAXPOINTS = 16;
+
+    /// version of the .ppb layout below
+    static const unsigned char FORMAT = 2;
+
+public:
+    /**
+     * Precompiled profile, read in one block: the form of a .ppb file,
+     * of each PaperLibrary index record and of PaperCache's EEPROM
+     * copies.  All fields are bytes so any host can produce it; srcsize
+     * is the length of the .ppr it was built from (LSB first, 0 if
+     * none) and sum is the xor of every other byte.
+     */
+    struct Image {
+        char magic[3];                    // "PPB"
+        unsigned char version;            // FORMAT
+        unsigned char srcsize[4];
+        char name[NAMELEN];               // NUL-padded
+        unsigned char maxBrightnessSoft;
+        unsigned char maxBrightnessHard;
+        unsigned char minGrade;
+        unsigned char maxGrade;
+        unsigned char points;
+        unsigned char pointGrade[MAXPOINTS];
+        unsigned char pointSoft[MAXPOINTS];
+        unsigned char pointHard[MAXPOINTS];
+        unsigned char sum;
+    };
 
-    String name;
-    unsigned char amountsSoft[GRADES];
-    unsigned char amountsHard[GRADES];
-    bool sdready;
+    /// current profile as an image
+    void toImage(Image& img) const;
+
+    /// take the profile from an image if it is intact
+    /// @param srcsize size of the .ppr it must match, 0 for any
+    bool fromImage(const Image& img, unsigned long srcsize);
+
+private:
+    char name[NAMELEN+1];
+    /**
+     * Soft and hard power are piecewise linear in grade between control
+     * points at ascending grades, and flat beyond the ends.  Tables
+     * given at 5-grade steps are thinned to at most MAXPOINTS by
+     * setCurve(), so any integer grade is available from fewer bytes.
+     */
+    unsigned char points;
+    unsigned char pointGrade[MAXPOINTS];
+    unsigned char pointSoft[MAXPOINTS];
+    unsigned char pointHard[MAXPOINTS];
+    /// size of the .ppr this profile came from, 0 if none
+    unsigned long srcsize;
+    /// bumped whenever the tables change
+    unsigned int generation;
 
     bool initFromFile(File& dataFile);
-    unsigned char parseLevel(String brightness);
-    String readLine(File& dataFile);
+    /// take the profile from a .ppb if it is intact and current
+    bool initFromImage(File& dataFile, unsigned long srcsize);
+    static unsigned char imageSum(const Image& img);
     void initDefault();
+    /// keep the fewest samples that reproduce the rest within a power
+    /// unit or so; grades ascending, n <= GRADES
+    void setCurve(const unsigned char *grade, const unsigned char *soft,
+                  const unsigned char *hard, unsigned char n);
+    /// worst error over samples a..b when only a and b are kept
+    static int spanError(const unsigned char *grade, const unsigned char *amount,
+                         unsigned char a, unsigned char b);
+    /// power at grade on the line through control points i and i+1,
+    /// or a step between them if either is LEDDriver::LED_OFF
+    static unsigned char interpolate(unsigned char g0, unsigned char v0,
+                                     unsigned char g1, unsigned char v1,
+                                     unsigned char grade);
+    unsigned char evaluate(const unsigned char *amount, unsigned char grade) const;
+    /// as evaluate() but keeping the fraction, in LEDDriver fine powers
+    unsigned int evaluateFine(const unsigned char *amount, unsigned char grade) const;
 
 public:
-    void init(bool sdready);
-    bool load(char paper);	
+    /// start from the built-in default profile
+    void init();
+    /// read a .ppr or .ppb file; the default profile if it fails
+    bool load(const char *path);
 
     unsigned char minGrade; 
     unsigned char maxGrade;
@@ -57,7 +125,17 @@ public:
 
     unsigned char getAmountSoft(unsigned char grade);
     unsigned char getAmountHard(unsigned char grade);
-    String& getName();
+    /// power between control points without rounding to a whole level
+    unsigned int getFineSoft(unsigned char grade);
+    unsigned int getFineHard(unsigned char grade);
+    const char *getName() const {
+        return name;
+    }
+
+    /// changes whenever a different profile is loaded
+    unsigned int getGeneration() const {
+        return generation;
+    }
 };
 
 #endif
@@ -0,0 +1,192 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "PaperCache.h"
+
+PaperCache::PaperCache(PaperLibrary &lib)
+    : library(lib)
+{
+    for(int k=0;k<SLOTS;++k){
+        files[k][0]='\0';
+        rank[k]=k;
+    }
+    cur=0;
+}
+
+int PaperCache::slotAddr(int slot) const
+{
+    return EE_PAPERCACHE+slot*(PaperLibrary::FILELEN+1+sizeof(Paper::Image));
+}
+
+void PaperCache::begin()
+{
+    bool seen[SLOTS];
+    bool ranksok=true;
+    for(int k=0;k<SLOTS;++k)
+        seen[k]=false;
+
+    for(int k=0;k<SLOTS;++k){
+        int addr=slotAddr(k);
+        Paper &p=papers[k];
+        p.init();
+
+        for(int i=0;i<PaperLibrary::FILELEN;++i)
+            files[k][i]=EEPROM.read(addr++);
+        rank[k]=EEPROM.read(addr++);
+        if(rank[k] < SLOTS && !seen[rank[k]])
+            seen[rank[k]]=true;
+        else
+            ranksok=false;
+
+        // never written (0xFF) or the default profile (empty)
+        files[k][PaperLibrary::FILELEN-1]='\0';
+        if(!isalnum(files[k][0])){
+            files[k][0]='\0';
+            continue;
+        }
+        Paper::Image img;
+        unsigned char *b=(unsigned char *)&img;
+        for(unsigned int i=0;i<sizeof(Paper::Image);++i)
+            b[i]=EEPROM.read(addr++);
+        if(!p.fromImage(img, 0))
+            files[k][0]='\0';
+    }
+    if(!ranksok){
+        for(int k=0;k<SLOTS;++k)
+            rank[k]=k;
+        persistRanks();
+    }
+
+    // most recent paper that was restored
+    int best=-1;
+    for(int k=0;k<SLOTS;++k){
+        if(files[k][0] && (best < 0 || rank[k] < rank[best]))
+            best=k;
+    }
+    if(best >= 0){
+        cur=best;
+        return;
+    }
+
+    cur=victim();
+    if(library.getCount() > 0)
+        select(0);
+}
+
+bool PaperCache::select(unsigned int k)
+{
+    PaperLibrary::Record r;
+    if(!library.getRecord(k, r))
+        return false;
+
+    int slot=-1;
+    for(int j=0;j<SLOTS;++j){
+        if(files[j][0] && strcasecmp(files[j], r.file) == 0)
+            slot=j;
+    }
+
+    // cached and not asking for a refresh; nothing to read
+    if(slot >= 0 && slot != cur){
+        cur=slot;
+        touch(slot);
+        return true;
+    }
+
+    // the current paper again: its file may have been edited in a way
+    // the index can't see, so parse it rather than trust the index
+    if(slot == cur)
+        library.reread(k, r);
+
+    if(slot < 0)
+        slot=victim();
+    Paper &p=papers[slot];
+    bool ok=p.fromImage(r.image, 0);
+    if(ok){
+        strcpy(files[slot], r.file);
+    }
+    else{
+        p.init();
+        files[slot][0]='\0';
+    }
+    cur=slot;
+    persist(slot);
+    touch(slot);
+    return ok;
+}
+
+void PaperCache::revalidate()
+{
+    for(int k=0;k<SLOTS;++k){
+        if(!files[k][0])
+            continue;
+        // papers no longer on the card stay as they were
+        int pos=library.find(files[k]);
+        if(pos != PaperLibrary::NOTFOUND && library.load(pos, papers[k]))
+            persist(k);
+    }
+}
+
+void PaperCache::touch(int slot)
+{
+    for(int k=0;k<SLOTS;++k){
+        if(rank[k] < rank[slot])
+            ++rank[k];
+    }
+    rank[slot]=0;
+    persistRanks();
+}
+
+int PaperCache::victim() const
+{
+    int v=0;
+    for(int k=1;k<SLOTS;++k){
+        if(rank[k] > rank[v])
+            v=k;
+    }
+    return v;
+}
+
+void PaperCache::persist(int slot)
+{
+    Paper::Image img;
+    papers[slot].toImage(img);
+
+    // spare the cells that already hold the right value
+    int addr=slotAddr(slot);
+    for(int i=0;i<PaperLibrary::FILELEN;++i,++addr){
+        if(EEPROM.read(addr) != (unsigned char)files[slot][i])
+            EEPROM.write(addr, files[slot][i]);
+    }
+    ++addr;
+    if(!files[slot][0])
+        return;
+    const unsigned char *b=(const unsigned char *)&img;
+    for(unsigned int i=0;i<sizeof(Paper::Image);++i,++addr){
+        if(EEPROM.read(addr) != b[i])
+            EEPROM.write(addr, b[i]);
+    }
+}
+
+void PaperCache::persistRanks()
+{
+    for(int k=0;k<SLOTS;++k){
+        int addr=slotAddr(k)+PaperLibrary::FILELEN;
+        if(EEPROM.read(addr) != rank[k])
+            EEPROM.write(addr, rank[k]);
+    }
+}
@@ -0,0 +1,90 @@
+/* -*- C++ -*- */
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _PAPER_CACHE_H_
+#define _PAPER_CACHE_H_
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "EEPROMLayout.h"
+#include "Paper.h"
+#include "PaperLibrary.h"
+
+/**
+ * The last few papers used, decoded and ready.  Selecting a cached
+ * paper only changes which one is current; anything else is read from
+ * the PaperLibrary into the least-recently-used slot.
+ *
+ * Every slot is mirrored at EE_PAPERCACHE as the paper's file name, its
+ * recency and a Paper::Image, so the papers in use survive a reboot and
+ * are there even with no card.  EEPROM is written only when a slot is
+ * refilled or the order of use changes.
+ */
+class PaperCache {
+public:
+
+    static const int SLOTS=3;
+
+    PaperCache(PaperLibrary &lib);
+
+    /// restore the slots from EEPROM and make the most recent current;
+    /// the library's first paper is read if nothing was saved
+    void begin();
+
+    /// make library entry k current, reading it if not cached;
+    /// selecting the current paper again re-reads its file
+    /// @return false if it could not be read; current is then the
+    ///         default profile (or unchanged if k is out of range)
+    bool select(unsigned int k);
+
+    /// re-read every cached paper from a rebuilt library
+    void revalidate();
+
+    Paper &current() {
+        return papers[cur];
+    }
+
+    /// file name of the current paper, empty for the default profile
+    const char *currentFile() const {
+        return files[cur];
+    }
+
+private:
+
+    /// make slot the most recently used
+    void touch(int slot);
+    /// least recently used slot
+    int victim() const;
+
+    int slotAddr(int slot) const;
+    /// mirror one slot's profile to EEPROM
+    void persist(int slot);
+    /// mirror every slot's recency to EEPROM
+    void persistRanks();
+
+    PaperLibrary &library;
+    Paper papers[SLOTS];
+    /// library file each slot came from; empty for the default profile
+    char files[SLOTS][PaperLibrary::FILELEN];
+    /// 0 is most recently used
+    unsigned char rank[SLOTS];
+    int cur;
+};
+
+#endif // _PAPER_CACHE_H_
@@ -0,0 +1,310 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "PaperLibrary.h"
+
+static const char DIRNAME[]="/papers";
+static const char INDEXNAME[]="INDEX.PPI";
+
+void PaperLibrary::makePath(char *path, const char *file)
+{
+    strcpy(path, DIRNAME);
+    strcat(path, "/");
+    strcat(path, file);
+}
+
+PaperLibrary::PaperLibrary()
+{
+    sdready=false;
+    count=0;
+}
+
+bool PaperLibrary::begin(bool ready)
+{
+    sdready=ready;
+    count=0;
+    return refresh();
+}
+
+bool PaperLibrary::refresh()
+{
+    if(!sdready)
+        return false;
+
+    unsigned int papers;
+    unsigned long signature=scan(papers);
+
+    char path[sizeof(DIRNAME)+1+FILELEN];
+    makePath(path, INDEXNAME);
+    File f=SD.open(path, FILE_READ);
+    if(f){
+        unsigned char h[HEADERLEN];
+        bool ok=f.read(h, HEADERLEN) == HEADERLEN
+            && h[0] == 'P' && h[1] == 'P' && h[2] == 'I' && h[3] == FORMAT;
+        f.close();
+        unsigned long stored=0;
+        for(char i=9;i >= 6;--i)
+            stored=(stored << 8) | h[(int)i];
+        if(ok){
+            count=h[4] | (h[5] << 8);
+            if(stored == signature)
+                return false;
+            if(update(signature, papers))
+                return true;
+        }
+    }
+
+    rebuild(signature, papers);
+    return true;
+}
+
+bool PaperLibrary::isPaper(const char *file)
+{
+    int len=strlen(file);
+    if(len < 5 || file[len-4] != '.' || toupper(file[len-3]) != 'P'
+       || toupper(file[len-2]) != 'P')
+        return false;
+
+    char ext=toupper(file[len-1]);
+    if(ext == 'R')
+        return true;
+    if(ext != 'B')
+        return false;
+
+    // images stand in for text only when there is none
+    char path[sizeof(DIRNAME)+1+FILELEN];
+    makePath(path, file);
+    path[strlen(path)-1]='R';
+    return !SD.exists(path);
+}
+
+unsigned long PaperLibrary::scan(unsigned int &papers)
+{
+    // FNV-1a over each file's name and size
+    unsigned long hash=2166136261UL;
+    papers=0;
+
+    File dir=SD.open(DIRNAME);
+    if(!dir)
+        return hash;
+    dir.rewindDirectory();
+    while(true){
+        File e=dir.openNextFile();
+        if(!e)
+            break;
+        const char *name=e.name();
+        if(!e.isDirectory() && strcasecmp(name, INDEXNAME) != 0){
+            for(const char *c=name;*c;++c)
+                hash=(hash ^ (unsigned char)toupper(*c))*16777619UL;
+            unsigned long size=e.size();
+            for(char i=0;i<4;++i){
+                hash=(hash ^ (size & 0xFF))*16777619UL;
+                size>>=8;
+            }
+            if(isPaper(name))
+                ++papers;
+        }
+        e.close();
+    }
+    dir.close();
+    return hash;
+}
+
+bool PaperLibrary::update(unsigned long signature, unsigned int papers)
+{
+    if(papers != count)
+        return false;
+
+    // not FILE_WRITE, which may append
+    char path[sizeof(DIRNAME)+1+FILELEN];
+    makePath(path, INDEXNAME);
+    File f=SD.open(path, O_READ | O_WRITE);
+    if(!f)
+        return false;
+
+    // same order as scan(); the directory entry gives each size without
+    // opening the paper, which is only read again if that has changed
+    Paper p;
+    Record r;
+    unsigned int n=0;
+    bool ok=true;
+    File dir=SD.open(DIRNAME);
+    if(dir){
+        dir.rewindDirectory();
+        while(ok && n < papers){
+            File e=dir.openNextFile();
+            if(!e)
+                break;
+            if(!e.isDirectory() && isPaper(e.name())){
+                unsigned long at=HEADERLEN+(unsigned long)n*sizeof(Record);
+                ok=f.seek(at) && f.read(&r, sizeof(Record)) == (int)sizeof(Record);
+                r.file[FILELEN-1]='\0';
+                ok=ok && strcasecmp(r.file, e.name()) == 0;
+                if(ok && r.size != e.size()){
+                    makePath(path, r.file);
+                    memset(&r.image, 0, sizeof(r.image));
+                    if(p.load(path))
+                        p.toImage(r.image);
+                    r.size=e.size();
+                    ok=f.seek(at)
+                        && f.write((const uint8_t *)&r, sizeof(Record)) == sizeof(Record);
+                }
+                ++n;
+            }
+            e.close();
+        }
+        dir.close();
+    }
+
+    // every record checked; only now does the header vouch for them
+    ok=ok && n == papers && f.seek(6);
+    for(char i=0;ok && i < 4;++i){
+        ok=f.write((uint8_t)(signature & 0xFF)) == 1;
+        signature>>=8;
+    }
+    f.close();
+    return ok;
+}
+
+void PaperLibrary::rebuild(unsigned long signature, unsigned int papers)
+{
+    char path[sizeof(DIRNAME)+1+FILELEN];
+    makePath(path, INDEXNAME);
+
+    // FILE_WRITE appends
+    if(SD.exists(path))
+        SD.remove(path);
+    File out=SD.open(path, FILE_WRITE);
+    if(!out){
+        count=0;
+        return;
+    }
+
+    unsigned char h[HEADERLEN]={'P', 'P', 'I', FORMAT,
+                                (unsigned char)(papers & 0xFF),
+                                (unsigned char)(papers >> 8)};
+    for(char i=6;i < HEADERLEN;++i){
+        h[(int)i]=signature & 0xFF;
+        signature>>=8;
+    }
+    out.write(h, HEADERLEN);
+
+    // same order as scan(); the index itself was made before it so
+    // creating it doesn't disturb the listing
+    Paper p;
+    Record r;
+    unsigned int n=0;
+    File dir=SD.open(DIRNAME);
+    if(dir){
+        dir.rewindDirectory();
+        while(n < papers){
+            File e=dir.openNextFile();
+            if(!e)
+                break;
+            if(!e.isDirectory() && isPaper(e.name())){
+                memset(&r, 0, sizeof(Record));
+                strncpy(r.file, e.name(), FILELEN-1);
+                r.size=e.size();
+                makePath(path, r.file);
+                // an unreadable paper keeps its place with a bad image
+                if(p.load(path))
+                    p.toImage(r.image);
+                out.write((const uint8_t *)&r, sizeof(Record));
+                ++n;
+            }
+            e.close();
+        }
+        dir.close();
+    }
+
+    // the listing came up short; pad so the header holds
+    memset(&r, 0, sizeof(Record));
+    for(;n < papers;++n)
+        out.write((const uint8_t *)&r, sizeof(Record));
+    out.close();
+    count=papers;
+}
+
+bool PaperLibrary::getRecord(unsigned int k, Record &r)
+{
+    if(k >= count)
+        return false;
+
+    char path[sizeof(DIRNAME)+1+FILELEN];
+    makePath(path, INDEXNAME);
+    File f=SD.open(path, FILE_READ);
+    if(!f)
+        return false;
+    bool ok=f.seek(HEADERLEN+(unsigned long)k*sizeof(Record))
+        && f.read(&r, sizeof(Record)) == (int)sizeof(Record);
+    f.close();
+    r.file[FILELEN-1]='\0';
+    return ok;
+}
+
+bool PaperLibrary::load(unsigned int k, Paper &p)
+{
+    Record r;
+    return getRecord(k, r) && p.fromImage(r.image, 0);
+}
+
+bool PaperLibrary::reread(unsigned int k, Record &r)
+{
+    if(!getRecord(k, r))
+        return false;
+
+    char path[sizeof(DIRNAME)+1+FILELEN];
+    makePath(path, r.file);
+    Paper p;
+    if(!p.load(path))
+        return false;
+    p.toImage(r.image);
+
+    // not FILE_WRITE, which may append
+    makePath(path, INDEXNAME);
+    File f=SD.open(path, O_READ | O_WRITE);
+    if(f){
+        if(f.seek(HEADERLEN+(unsigned long)k*sizeof(Record)))
+            f.write((const uint8_t *)&r, sizeof(Record));
+        f.close();
+    }
+    return true;
+}
+
+int PaperLibrary::find(const char *file)
+{
+    char path[sizeof(DIRNAME)+1+FILELEN];
+    makePath(path, INDEXNAME);
+    File f=SD.open(path, FILE_READ);
+    if(!f)
+        return NOTFOUND;
+
+    // names only; skip the images
+    int found=NOTFOUND;
+    char name[FILELEN];
+    for(unsigned int k=0;k < count && found == NOTFOUND;++k){
+        if(!f.seek(HEADERLEN+(unsigned long)k*sizeof(Record))
+           || f.read(name, FILELEN) != FILELEN)
+            break;
+        name[FILELEN-1]='\0';
+        if(strcasecmp(name, file) == 0)
+            found=k;
+    }
+    f.close();
+    return found;
+}
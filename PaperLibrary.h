@@ -0,0 +1,104 @@
+/* -*- C++ -*- */
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _PAPER_LIBRARY_H_
+#define _PAPER_LIBRARY_H_
+
+#include <Arduino.h>
+#include <SD.h>
+#include "Paper.h"
+
+/**
+ * Every paper in /papers, indexed in /papers/INDEX.PPI so that listing
+ * and loading them takes one seek and one read however many there are.
+ *
+ * The index is a header (magic, version, count, directory signature)
+ * followed by fixed-size records in directory order, each the paper's
+ * file name and its compiled Paper::Image.  The signature hashes the
+ * name and size of every other file in /papers; when it no longer
+ * matches, the index is rebuilt.  An edit that keeps a file's size
+ * goes unseen, so reread() parses one paper's file again on request
+ * and puts the result back in the index.  A .ppb is indexed only if
+ * there is no .ppr of the same name.
+ */
+class PaperLibrary {
+public:
+
+    /// 8.3 name and terminator
+    static const int FILELEN=13;
+
+    class Record {
+    public:
+        char file[FILELEN];
+        Paper::Image image;
+        unsigned long size;     ///< of the file the image was read from
+    };
+
+    PaperLibrary();
+
+    /// check the index, rebuilding it if /papers has changed
+    /// @return true if it was rebuilt
+    bool begin(bool sdready);
+
+    /// check the index again, eg after the card was edited
+    /// @return true if it was rebuilt
+    bool refresh();
+
+    unsigned int getCount() const {
+        return count;
+    }
+
+    /// fetch entry k; its image is checked by Paper::fromImage()
+    bool getRecord(unsigned int k, Record &r);
+
+    /// entry k into a Paper
+    bool load(unsigned int k, Paper &p);
+
+    /// fetch entry k, reading its image afresh from the paper's file
+    /// and updating the index with it
+    /// @return false if the paper's file could not be read; r is then
+    ///         as indexed, if that could be read
+    bool reread(unsigned int k, Record &r);
+
+    /// position of a file in the index, or NOTFOUND (linear)
+    int find(const char *file);
+    static const int NOTFOUND=-1;
+
+private:
+
+    static const unsigned char FORMAT=2;
+    static const int HEADERLEN=10;
+
+    /// DIRNAME/file
+    static void makePath(char *path, const char *file);
+    /// hash of /papers less the index; counts the papers as it goes
+    unsigned long scan(unsigned int &papers);
+    /// a file that belongs in the index
+    bool isPaper(const char *file);
+    /// bring the index up to date in place, rereading only papers whose
+    /// size has changed
+    /// @return false if the list of papers itself changed
+    bool update(unsigned long signature, unsigned int papers);
+    void rebuild(unsigned long signature, unsigned int papers);
+
+    bool sdready;
+    unsigned int count;
+};
+
+#endif // _PAPER_LIBRARY_H_
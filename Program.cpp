@@ -18,18 +18,66 @@
 
 #include "Program.h"
 
+/**
+ * Mantissas for hunToMicros(): round(1000 * 2^(k/100) * 2^HUNSHIFT)
+ * for k=0..99, in milliseconds; hunToMicros() takes the last factor of
+ * 1000 itself.  Generated offline at high precision, e.g. in Python:
+ *   [round(1000*2**(k/100)*2**21) for k in range(100)]
+ * (avr-gcc's double is only 32 bits, so the compiler can't produce them).
+ */
+static const unsigned long HUNTAB[100] PROGMEM={
+    0x7D000000UL, 0x7DDE93DEUL, 0x7EBEB40FUL, 0x7FA06355UL, 0x8083A478UL,
+    0x81687A42UL, 0x824EE783UL, 0x8336EF12UL, 0x842093CAUL, 0x850BD889UL,
+    0x85F8C035UL, 0x86E74DB7UL, 0x87D783FEUL, 0x88C96600UL, 0x89BCF6B6UL,
+    0x8AB2391DUL, 0x8BA9303CUL, 0x8CA1DF1BUL, 0x8D9C48CAUL, 0x8E98705CUL,
+    0x8F9658EDUL, 0x9096059AUL, 0x9197798AUL, 0x929AB7E7UL, 0x939FC3E2UL,
+    0x94A6A0B0UL, 0x95AF518CUL, 0x96B9D9B9UL, 0x97C63C7EUL, 0x98D47D28UL,
+    0x99E49F09UL, 0x9AF6A57AUL, 0x9C0A93DBUL, 0x9D206D90UL, 0x9E383605UL,
+    0x9F51F0A9UL, 0xA06DA0F4UL, 0xA18B4A63UL, 0xA2AAF07BUL, 0xA3CC96C4UL,
+    0xA4F040CEUL, 0xA615F230UL, 0xA73DAE87UL, 0xA8677976UL, 0xA99356A7UL,
+    0xAAC149C9UL, 0xABF15693UL, 0xAD2380C3UL, 0xAE57CC1DUL, 0xAF8E3C6CUL,
+    0xB0C6D581UL, 0xB2019B34UL, 0xB33E9164UL, 0xB47DBBF8UL, 0xB5BF1EDDUL,
+    0xB702BE05UL, 0xB8489D6EUL, 0xB990C117UL, 0xBADB2D0BUL, 0xBC27E55BUL,
+    0xBD76EE1DUL, 0xBEC84B71UL, 0xC01C017CUL, 0xC172146DUL, 0xC2CA8879UL,
+    0xC42561DCUL, 0xC582A4DBUL, 0xC6E255C0UL, 0xC84478E0UL, 0xC9A91295UL,
+    0xCB102743UL, 0xCC79BB54UL, 0xCDE5D33AUL, 0xCF547370UL, 0xD0C5A079UL,
+    0xD2395EDEUL, 0xD3AFB333UL, 0xD528A211UL, 0xD6A4301CUL, 0xD82261FFUL,
+    0xD9A33C6EUL, 0xDB26C423UL, 0xDCACFDE4UL, 0xDE35EE7DUL, 0xDFC19AC3UL,
+    0xE1500794UL, 0xE2E139D7UL, 0xE475367BUL, 0xE60C0278UL, 0xE7A5A2CEUL,
+    0xE9421C89UL, 0xEAE174B9UL, 0xEC83B07CUL, 0xEE28D4F6UL, 0xEFD0E755UL,
+    0xF17BECD0UL, 0xF329EAA9UL, 0xF4DAE628UL, 0xF68EE4A1UL, 0xF845EB72UL,
+};
+
+Program::Program()
+{
+    isstrip=false;
+    cover=false;
+    striprows=1;
+    stripcols=MAXSTEPS;
+    for(unsigned char r=0;r<MAXROWS;++r){
+        rowgrade[r]=0;
+        rowoffset[r]=0;
+    }
+    key.valid=false;
+}
+
 void Program::clear()
 {
     // base
     steps[0].stops=300;
     steps[0].grade=100;
+    steps[0].parent=0;
+    steps[0].corner=false;
     strcpy(steps[0].text, "Base Exposure");
     isstrip=false;
+    key.valid=false;
    
     // invalid
     for(int i=1;i<MAXSTEPS;++i){
         steps[i].stops=0;
         steps[i].grade=100;
+        steps[i].parent=0;
+        steps[i].corner=false;
         strcpy(steps[i].text, "Undefined");
     }
 
@@ -40,181 +88,461 @@ void Program::clearExposures()
 {
     // invalid
     for(int i=0;i<MAXEXPOSURES;++i){
-        exposures[i].ms=0;
+        exposures[i].us=0;
+        exposures[i].cornerus=0;
+        exposures[i].hold=NULL;
+        exposures[i].holdsteps=0;
     }
 }
 
-void Program::configureStrip(int base, int step, bool cov, unsigned char grade, Paper& p)
+void Program::configureStrip(int base, int step, bool cov, unsigned char grade,
+                             unsigned char rows, int gradestep, bool stagger, Paper& p)
 {
     isstrip=true;
     cover=cov;
+    striprows=constrain(rows, 1, MAXROWS);
+    stripcols=min(MAXSTEPS, MAXEXPOSURES/striprows);
+
+    // rows live outside steps[] so aren't seen by changedSteps()
+    for(unsigned char r=0;r<striprows;++r){
+        unsigned char g=constrain(grade+r*gradestep, p.minGrade, p.maxGrade);
+        int off=stagger ? r*step/striprows : 0;
+        if(g != rowgrade[r] || off != rowoffset[r])
+            key.valid=false;
+        rowgrade[r]=g;
+        rowoffset[r]=off;
+    }
+    if(key.striprows != striprows)
+        key.valid=false;
 
     int expos=base;
     for(char i=0;i<MAXSTEPS;++i) {
-        steps[i].stops=expos;
+        steps[i].stops=i < stripcols ? expos : 0;
         steps[i].grade=grade;
-        strcpy(steps[i].text, "Strip ");
-        dtostrf(0.01f*expos, 1, 2, &steps[i].text[6]);
-        strcpy(&steps[i].text[10], cov ? " Cov" : " Ind");
+        steps[i].parent=0;
+        steps[i].corner=false;
+        if(striprows == 1){
+            strcpy(steps[i].text, "Strip ");
+            dtostrf(0.01f*expos, 1, 2, &steps[i].text[6]);
+            strcpy(&steps[i].text[10], cov ? " Cov" : " Ind");
+        }
+        else{
+            // stops and grade differ by row; the exposure shows both
+            strcpy(steps[i].text, "Strip column ");
+            itoa(i+1, &steps[i].text[13], 10);
+            strcat(steps[i].text, cov ? " Cov" : " Ind");
+        }
         expos+=step;
     }
 }
 
-void Program::clipExposures()
+void Program::finishExposure(int which, const LampModel& lamp, const ZoneBalance& zb, unsigned long fitus)
 {
-    // don't want to be here forever or overflow the screen
-    for(char i=0;i<MAXEXPOSURES;++i){
-        if(exposures[i].ms > MAXMS) 
-            exposures[i].ms = MAXMS;
+    Exposure &e=exposures[which];
+    if(fitus != 0)
+        fitPower(e, fitus);
+    unsigned int stretch=zb.apply(e.hardpower, e.softpower, e.hardcorner, e.softcorner);
+    if(e.us == 0 && e.cornerus == 0)
+        return;
+
+    // each exposure is one on/off cycle of each zone's lamps, at that
+    // zone's powers
+    // a zone dodged right out stays dark
+    if(e.us != 0)
+        e.us=finishTime(e.us, stretch, lamp.getZoneOffset(false, e.hardpower, e.softpower));
+    if(e.cornerus != 0)
+        e.cornerus=finishTime(e.cornerus, stretch, lamp.getZoneOffset(true, e.hardcorner, e.softcorner));
+}
+
+void Program::fitPower(Exposure &e, unsigned long fitus)
+{
+    unsigned int rh=LEDDriver::relativeOutput(true, e.hardpower);
+    unsigned int rs=LEDDriver::relativeOutput(false, e.softpower);
+    unsigned int top=max(rh, rs);
+    if((e.us == 0 && e.cornerus == 0) || top == 0)
+        return;
+
+    // scale on output, in 1/1024ths, bringing the longer zone to fitus; at
+    // most full power and at least each lit type's dimmest stable level.
+    // The fraction of len/fitus comes 32ths at a time to stay within 32
+    // bits for any fitus under 2^27
+    unsigned long len=max(e.us, e.cornerus);
+    unsigned long r=len%fitus;
+    unsigned long k=(len/fitus) << 10;
+    k+=((r << 5)/fitus) << 5;
+    k+=(((r << 5)%fitus) << 5)/fitus;
+    unsigned long kmax=(1024UL << 10)/top;
+    unsigned long kmin=0;
+    if(rh)
+        kmin=max(kmin, ((unsigned long)LEDDriver::relativeOutput(true, LEDDriver::toFine(LEDDriver::LED_HARD_MIN)) << 10)/rh+1);
+    if(rs)
+        kmin=max(kmin, ((unsigned long)LEDDriver::relativeOutput(false, LEDDriver::toFine(LEDDriver::LED_SOFT_MIN)) << 10)/rs+1);
+    if(kmin > kmax)
+        return;
+    k=constrain(k, kmin, kmax);
+    if(k == 1024)
+        return;
+
+    if(rh)
+        e.hardpower=LEDDriver::relativePower(true, max(1UL, (rh*k+512) >> 10));
+    if(rs)
+        e.softpower=LEDDriver::relativePower(false, max(1UL, (rs*k+512) >> 10));
+
+    // same dose at the output actually set; split to stay within 32 bits
+    unsigned int now=max(LEDDriver::relativeOutput(true, e.hardpower),
+                         LEDDriver::relativeOutput(false, e.softpower));
+    e.us=(e.us/now)*top+((e.us%now)*top+now/2)/now;
+    e.cornerus=(e.cornerus/now)*top+((e.cornerus%now)*top+now/2)/now;
+}
+
+unsigned long Program::finishTime(unsigned long us, unsigned int stretch, long offset)
+{
+    // a zone that would need more than full power dims them all instead;
+    // split to stay within 32 bits for any us
+    if(stretch != ZoneBalance::UNITY){
+        const unsigned int u=ZoneBalance::UNITY;
+        us=(us/u)*stretch+((us%u)*stretch+u/2)/u;
     }
+
+    // don't want to be here forever or overflow the screen
+    if(us > MAXUS) 
+        us = MAXUS;
+
+    long adj=us-offset;
+
+    // never let a real exposure vanish; us=0 means "no exposure"
+    return adj < 1 ? 1 : adj;
 }
 
-bool Program::compile(char dryval, bool splitgrade, Paper& p)
+bool Program::compile(char dryval, bool splitgrade, unsigned char fit, Paper& p, const LampModel& lamp, const ZoneBalance& zb)
 {
-	clearExposures();
-	
-    if(isstrip){
-        if(cover)
-            compileStripCover(dryval, p);
-        else
-            compileStripIndiv(dryval, p);
-
-        clipExposures();
+    // which steps need their exposures redone?
+    bool nested=!isstrip && isNested();
+    unsigned char changed=ALLSTEPS;
+    if(key.valid && key.isstrip == isstrip && key.cover == cover
+       && key.nested == nested
+       && key.splitgrade == splitgrade && key.dryval == dryval && key.fit == fit
+       && key.paper == &p && key.papergen == p.getGeneration()
+       && key.lampgen == lamp.getGeneration()
+       && key.balancegen == zb.getGeneration()){
+        changed=changedSteps();
+    }
+
+    // nothing to do; exposures[] are still good
+    if(0 == changed)
         return true;
+
+    key.valid=false;
+
+    // exposures someone dodges or burns through want time to do it in;
+    // the rest are best over quickly
+    unsigned long stepfit=fit*1000000UL;
+    unsigned long plainfit=fit ? FITMINUS : 0;
+
+    // every exposure in nested mode can depend on every step
+    if(nested)
+        changed=ALLSTEPS;
+    if(ALLSTEPS == changed)
+        clearExposures();
+
+    if(nested){
+        if(!compileNested(dryval, splitgrade, p))
+            return false;
+        for(int j=0;j<MAXEXPOSURES;++j)
+            finishExposure(j, lamp, zb, exposures[j].hold ? stepfit : plainfit);
+    }
+    else if(isstrip){
+        for(int i=0;i<stripcols;++i){
+            // in cover mode the next exposure is a difference from this one
+            bool redo=changed & (1 << i);
+            if(cover && i > 0)
+                redo=redo || (changed & (1 << (i-1)));
+            if(redo){
+                for(unsigned char r=0;r<striprows;++r){
+                    compileStrip(r, i, dryval, p);
+                    finishExposure(r*stripcols+i, lamp, zb, plainfit);
+                }
+            }
+        }
     }
     else{
-        return compileNormal(dryval, splitgrade, p);
+        // base step feeds every exposure
+        if(changed & 1)
+            changed=ALLSTEPS;
+        if(changed == ALLSTEPS)
+            baseus=hunToMicros(steps[0].stops-dryval);
+
+        int mult=splitgrade ? 2 : 1;
+        for(int i=1;i<MAXSTEPS;++i){
+            if(changed & (1 << i)){
+                compileNormalStep(i, dryval, splitgrade, p);
+                for(int j=i*mult;j<(i+1)*mult;++j)
+                    finishExposure(j, lamp, zb, stepfit);
+            }
+        }
+        if(!compileNormalBase(splitgrade, p))
+            return false;
+        for(int j=0;j<mult;++j)
+            finishExposure(j, lamp, zb, plainfit);
     }
+
+    // remember what we compiled from
+    key.valid=true;
+    key.isstrip=isstrip;
+    key.cover=cover;
+    key.nested=nested;
+    key.striprows=striprows;
+    key.splitgrade=splitgrade;
+    key.dryval=dryval;
+    key.fit=fit;
+    key.paper=&p;
+    key.papergen=p.getGeneration();
+    key.lampgen=lamp.getGeneration();
+    key.balancegen=zb.getGeneration();
+    for(int i=0;i<MAXSTEPS;++i){
+        key.stops[i]=steps[i].stops;
+        key.grade[i]=steps[i].grade;
+        key.parent[i]=steps[i].parent;
+        key.corner[i]=steps[i].corner;
+    }
+    return true;
 }
 
-void Program::compileStripIndiv(char dryval, Paper& p)
+unsigned char Program::changedSteps() const
 {
+    unsigned char changed=0;
     for(int i=0;i<MAXSTEPS;++i){
-        exposures[i].ms=hunToMillis(steps[i].stops-dryval);
-	    exposures[i].softpower=p.getAmountSoft(steps[i].grade);
-	    exposures[i].hardpower=p.getAmountHard(steps[i].grade);
-    	exposures[i].step = &steps[i];
+        if(key.stops[i] != steps[i].stops || key.grade[i] != steps[i].grade
+           || key.parent[i] != steps[i].parent || key.corner[i] != steps[i].corner)
+            changed|=1 << i;
     }
+    return changed;
 }
 
-void Program::compileStripCover(char dryval, Paper& p)
+void Program::compileStrip(unsigned char r, int c, char dryval, Paper& p)
 {
-    unsigned long sofar=0;
+    Exposure &e=exposures[r*stripcols+c];
+    int off=rowoffset[r];
+    e.us=hunToMicros(steps[c].stops+off-dryval);
+    if(cover && c > 0)
+        e.us-=hunToMicros(steps[c-1].stops+off-dryval);
+    e.stops=steps[c].stops+off;
+    e.grade=rowgrade[r];
+    e.cornerus=e.us;
+    e.softpower=p.getFineSoft(e.grade);
+    e.hardpower=p.getFineHard(e.grade);
+    e.step = &steps[c];
+}
 
-    for(int i=0;i<MAXSTEPS;++i){
-        unsigned long thisexp=hunToMillis(steps[i].stops-dryval);
-        exposures[i].ms=thisexp-sofar;
-	    exposures[i].softpower=p.getAmountSoft(steps[i].grade);
-	    exposures[i].hardpower=p.getAmountHard(steps[i].grade);
-    	exposures[i].step = &steps[i];
-        sofar+=exposures[i].ms;
+void Program::compileNormalStep(int i, char dryval, bool splitgrade, Paper& p)
+{
+    int j = splitgrade ? i*2 : i;
+    dodgeus[i]=0;
+    cornerus[i]=0;
+
+    if(steps[i].stops == 0 || steps[i].corner){
+        exposures[j].us=0;
+        exposures[j].cornerus=0;
+        exposures[j].hardpower=LEDDriver::FINE_OFF;
+        exposures[j].softpower=LEDDriver::FINE_OFF;
+        if (splitgrade){
+            exposures[j+1].us=0;
+            exposures[j+1].cornerus=0;
+            exposures[j+1].hardpower=LEDDriver::FINE_OFF;
+            exposures[j+1].softpower=LEDDriver::FINE_OFF;
+        }
+        if(steps[i].stops == 0)
+            return;
+    }
+
+    // total exposure desired for this step (base+adjustment)
+    unsigned long total=hunToMicros(steps[i].stops+steps[0].stops-dryval);
+    if(steps[i].corner){
+        // rides along with the base exposure, on the corner zone only
+        cornerus[i]=(long)total-(long)baseus;
+        return;
+    }
+
+    unsigned long diff;
+    if(steps[i].stops < 0){
+        // dodge; keep track of time taken from the base
+        diff=baseus-total;
+        dodgeus[i]=diff;
     }
+    else{
+        diff=total-baseus;
+    }
+
+    setExposure(j, diff, diff, &steps[i], splitgrade, p);
 }
 
-bool Program::compileNormal(char dryval, bool splitgrade, Paper& p)
+bool Program::compileNormalBase(bool splitgrade, Paper& p)
 {
-    // Serial.println("compileNormal");
-
-    // base exposure, perhaps with drydown
-    int base=steps[0].stops-dryval;
-
-    // Serial.print("steps[0].text:");
-    // Serial.println(steps[0].text);
-      
-    exposures[0].ms=hunToMillis(base);
-    exposures[0].softpower=p.getAmountSoft(steps[0].grade);
-    exposures[0].hardpower=p.getAmountHard(steps[0].grade);
-	exposures[0].step = &steps[0];
-
-	if (splitgrade){
-		exposures[0].step = &steps[0];
-		exposures[1].step = &steps[0];
-
-	    exposures[0].ms=hunToMillis(base);
-	    exposures[1].ms=hunToMillis(base);
-
-	    exposures[0].softpower=p.getAmountSoft(steps[0].grade);
-	    exposures[0].hardpower=LEDDriver::LED_OFF;
-	    exposures[1].softpower=LEDDriver::LED_OFF;
-	    exposures[1].hardpower=p.getAmountHard(steps[0].grade);
-	}else{
-		exposures[0].step = &steps[0];
-
-	    exposures[0].ms=hunToMillis(base);
-
-	    exposures[0].softpower=p.getAmountSoft(steps[0].grade);
-	    exposures[0].hardpower=p.getAmountHard(steps[0].grade);
-	}
-    
-    // figure out the total exposure desired for each step (base+adjustment)
     unsigned long dodgetime=0;
+    for(int i=1;i<MAXSTEPS;++i)
+        dodgetime+=dodgeus[i];
+
+    // fail if we have more dodge than base exposure
+    if(dodgetime > baseus)
+        return false;
+
+    // corner steps lengthen or shorten the corner zone's base exposure
+    long corner=baseus-dodgetime;
+    for(int i=1;i<MAXSTEPS;++i)
+        corner+=cornerus[i];
+    if(corner < 0)
+        return false;
+
+    // base exposure less the time spent dodging
+    setExposure(0, baseus-dodgetime, corner, &steps[0], splitgrade, p);
+    return true;
+}
+
+void Program::setExposure(int j, unsigned long us, unsigned long cornerus, Step *st, bool splitgrade, Paper& p)
+{
+    unsigned int soft=p.getFineSoft(st->grade);
+    unsigned int hard=p.getFineHard(st->grade);
+
+    exposures[j].step=st;
+    exposures[j].stops=st->stops;
+    exposures[j].grade=st->grade;
+    if(!splitgrade){
+        exposures[j].us=us;
+        exposures[j].cornerus=cornerus;
+        exposures[j].softpower=soft;
+        exposures[j].hardpower=hard;
+        return;
+    }
+
+    // split grade: the same soft and hard light the paper curve gives
+    // in us, but each delivered separately at full power, so the two
+    // halves take different (and shorter) times
+    exposures[j+1]=exposures[j];
+    exposures[j].us=LEDDriver::fullPowerTime(false, soft, us);
+    exposures[j].cornerus=LEDDriver::fullPowerTime(false, soft, cornerus);
+    exposures[j].softpower=soft == LEDDriver::FINE_OFF ? soft : LEDDriver::toFine(LEDDriver::LED_SOFT_MAX);
+    exposures[j].hardpower=LEDDriver::FINE_OFF;
+    exposures[j+1].us=LEDDriver::fullPowerTime(true, hard, us);
+    exposures[j+1].cornerus=LEDDriver::fullPowerTime(true, hard, cornerus);
+    exposures[j+1].softpower=LEDDriver::FINE_OFF;
+    exposures[j+1].hardpower=hard == LEDDriver::FINE_OFF ? hard : LEDDriver::toFine(LEDDriver::LED_HARD_MAX);
+}
+
+bool Program::isNested() const
+{
+    for(int i=1;i<MAXSTEPS;++i){
+        if(steps[i].stops != 0 && steps[i].parent != 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Nested dodges and burns.  A step with a parent lies inside the
+ * parent's area and its stops are relative to the parent, so every
+ * step i has a target total T[i] = base + the stops along its chain.
+ *
+ * Rather than base-then-each-burn, exposures are made in ascending
+ * order of target level.  The pass that raises the print from one
+ * level to the next lights every area whose target reaches the new
+ * level and holds back those that are already finished.  Total time
+ * at the easel is then the largest target, never a sum, and nested
+ * burns don't double-expose their inner areas.
+ *
+ * Each connected group of lit areas is exposed at the grade of its
+ * outermost step; groups at the same level and grade share one
+ * exposure.  Exposure::holdsteps marks every area that finished at
+ * the previous level and must be held back from now on; hold is the
+ * first of them.
+ */
+bool Program::compileNested(char dryval, bool splitgrade, Paper& p)
+{
+    bool used[MAXSTEPS];
+    int total[MAXSTEPS];
+    unsigned long target[MAXSTEPS];
+
+    used[0]=true;
+    total[0]=steps[0].stops-dryval;
+    target[0]=hunToMicros(total[0]);
     for(int i=1;i<MAXSTEPS;++i){
-		int pos_multiplier = splitgrade ? 2 : 1;
-		int j = i * pos_multiplier;
-		
-        if(steps[i].stops == 0){
-            exposures[j].ms=0;
-		    exposures[j].hardpower=LEDDriver::LED_OFF;
-		    exposures[j].softpower=LEDDriver::LED_OFF;
-			if (splitgrade){
-	            exposures[j+1].ms=0;
-			    exposures[j+1].hardpower=LEDDriver::LED_OFF;
-			    exposures[j+1].softpower=LEDDriver::LED_OFF;
-			}
+        used[i]=steps[i].stops != 0;
+        if(!used[i])
             continue;
-        }
 
-		if (splitgrade){
-			exposures[j].step = &steps[i];
-			exposures[j+1].step = &steps[i];
-
-		    exposures[j].ms=hunToMillis(base+steps[i].stops);
-		    exposures[j+1].ms=hunToMillis(base+steps[i].stops);
-
-		    exposures[j].softpower=p.getAmountSoft(steps[i].grade);
-		    exposures[j].hardpower=LEDDriver::LED_OFF;
-		    exposures[j+1].softpower=LEDDriver::LED_OFF;
-		    exposures[j+1].hardpower=p.getAmountHard(steps[i].grade);
-		}else{
-			exposures[j].step = &steps[i];
-
-		    exposures[j].ms=hunToMillis(base+steps[i].stops);
-
-		    exposures[j].softpower=p.getAmountSoft(steps[i].grade);
-		    exposures[j].hardpower=p.getAmountHard(steps[i].grade);
-		}
-
-        // is dodge?
-        if(steps[i].stops < 0){
-            // keep track of total time spent dodging          
-            dodgetime+=exposures[0].ms-exposures[j].ms;  
-            // convert to time-difference
-            exposures[j].ms=exposures[0].ms-exposures[j].ms;
-			if (splitgrade){
-	            exposures[j+1].ms=exposures[0].ms-exposures[j+1].ms;
-			}
+        // must nest inside an earlier step that's in use
+        int par=steps[i].parent;
+        if(par >= i || !used[par])
+            return false;
+        total[i]=total[par]+steps[i].stops;
+        target[i]=hunToMicros(total[i]);
+    }
+
+    int j=0;
+    unsigned long level=0;
+    for(;;){
+        // next target level up
+        unsigned long next=0;
+        for(int i=0;i<MAXSTEPS;++i){
+            if(used[i] && target[i] > level && (next == 0 || target[i] < next))
+                next=target[i];
         }
-        else{
-            // convert to time-difference
-            exposures[j].ms-=exposures[0].ms;          
-			if (splitgrade){
-	            exposures[j+1].ms-=exposures[0].ms;          
-			}
+        if(next == 0)
+            break;
+
+        // group roots: lit, with parent unlit (or the base)
+        unsigned char done=0;   // steps whose exposure is already emitted
+        for(int m=0;m<MAXSTEPS;++m){
+            if(!used[m] || target[m] < next || (done & (1 << m)))
+                continue;
+            if(m != 0 && target[steps[m].parent] >= next)
+                continue;
+
+            if(j+(splitgrade ? 2 : 1) > MAXEXPOSURES)
+                return false;
+
+            // same-grade group roots at this level go in the same exposure
+            Step *hold=NULL;
+            unsigned char holdsteps=0;
+            for(int g=m;g<MAXSTEPS;++g){
+                if(!used[g] || target[g] < next || steps[g].grade != steps[m].grade)
+                    continue;
+                if(g != 0 && target[steps[g].parent] >= next)
+                    continue;
+                done|=1 << g;
+
+                // newly-finished areas lying in g's group: up through
+                // unlit containers to the nearest lit one, then up
+                // through lit ones to the group's root
+                for(int d=g+1;d<MAXSTEPS;++d){
+                    if(!used[d] || target[d] != level)
+                        continue;
+                    int c=steps[d].parent;
+                    while(c != 0 && target[c] < next)
+                        c=steps[c].parent;
+                    while(c != 0 && target[steps[c].parent] >= next)
+                        c=steps[c].parent;
+                    if(c != g)
+                        continue;
+                    if(NULL == hold)
+                        hold=&steps[d];
+                    holdsteps|=1 << d;
+                }
+            }
+
+            setExposure(j, next-level, next-level, &steps[m], splitgrade, p);
+            exposures[j].hold=hold;
+            exposures[j].holdsteps=holdsteps;
+            if(splitgrade){
+                exposures[j+1].hold=hold;
+                exposures[j+1].holdsteps=holdsteps;
+                j+=2;
+            }
+            else{
+                ++j;
+            }
         }
+        level=next;
     }
-    
-    // fail if we have more dodge than base exposure
-    if(dodgetime > exposures[0].ms)
-        return false;
-    
-    // take off the dodgetime
-    exposures[0].ms-=dodgetime;
-	if (splitgrade){
-	    exposures[1].ms-=dodgetime;
-	}
-    
-    clipExposures();
-
     return true;
 }
 
@@ -226,6 +554,15 @@ void Program::Step::display(LiquidCrystal &disp, char *buf, bool lin)
     disp.print(text);
     displayGrade(disp, buf, lin);
     displayTime(disp, buf, lin);
+    if(parent != 0){
+        disp.setCursor(0,3);
+        disp.print("Inside step ");
+        disp.print(parent+1);
+    }
+    else if(corner){
+        disp.setCursor(0,3);
+        disp.print("Corners only");
+    }
 }
 
 void Program::Step::displayTime(LiquidCrystal &disp, char *buf, bool lin)
@@ -281,6 +618,30 @@ void Program::Exposure::display(LiquidCrystal &disp, char *buf, bool lin)
     disp.print(step->text);
     displayGrade(disp, buf, lin);
     displayTime(disp, buf, lin);
+    if(hold != NULL){
+        disp.setCursor(0,3);
+        disp.print("Hold:");
+        if(!(holdsteps & (holdsteps-1))){
+            disp.print(hold->text);
+        }
+        else{
+            // no room for several names; number them as the editor does
+            for(int i=0;i<MAXSTEPS;++i){
+                if(holdsteps & (1 << i)){
+                    itoa(i+1, buf, 10);
+                    disp.print(" ");
+                    disp.print(buf);
+                }
+            }
+        }
+    }
+    else if(cornerus != us){
+        disp.setCursor(0,3);
+        disp.print("Corners ");
+        dtostrf(0.000001f*cornerus, 0, cornerus < 10000000UL ? 4 : 3, buf);
+        disp.print(buf);
+        disp.print("s");
+    }
 }
 
 void Program::Exposure::displayTime(LiquidCrystal &disp, char *buf, bool lin)
@@ -289,18 +650,18 @@ void Program::Exposure::displayTime(LiquidCrystal &disp, char *buf, bool lin)
 
     // print stops
     char used=0;
-    if(step->stops >= 0){
+    if(stops >= 0){
         disp.print("+");
         ++used;
     }
-    dtostrf(0.01f*step->stops, 0, 2, buf);
+    dtostrf(0.01f*stops, 0, 2, buf);
     used+=strlen(buf);
     disp.print(buf);
 
     // print compiled seconds
     if(lin){
         disp.print("=");
-        dtostrf(0.001f*ms, 0, 3, buf);
+        dtostrf(0.000001f*us, 0, us < 10000000UL ? 4 : 3, buf);
         used+=strlen(buf)+2;
         disp.print(buf);
         disp.print("s");
@@ -323,15 +684,15 @@ void Program::Exposure::displayGrade(LiquidCrystal &disp, char *buf, bool lin)
     // print grade
     char used=0;
 
-    itoa(step->grade, buf, 10);
+    itoa(grade, buf, 10);
     used+=strlen(buf);
     disp.print(buf);
 
     //ToDo: Calculate these percentages based on the paper and the grade
     disp.print(" ");    
-    disp.print(softpower);    
+    disp.print(LEDDriver::toLevel(softpower));    
     disp.print(":");    
-    disp.print(hardpower);    
+    disp.print(LEDDriver::toLevel(hardpower));    
 }
 
 Program::Step &Program::getStep(int which)
@@ -344,9 +705,29 @@ Program::Exposure &Program::getExposure(int which)
     return exposures[which]; 
 }
 
-unsigned long Program::hunToMillis(int hunst)
+unsigned long Program::hunToMicros(int hunst)
 {
-    return lrint(1000.0f*pow(2.0f, 0.01f*hunst));
+    // hunst = 100*whole + frac, frac in 0..99 (floor, not truncation)
+    int whole=hunst/100;
+    int frac=hunst%100;
+    if(frac < 0){
+        frac+=100;
+        --whole;
+    }
+
+    // 1000000*2^(hunst/100) = 1000 * HUNTAB[frac] * 2^(whole-HUNSHIFT),
+    // rounded; the product needs 42 bits, so 10 come off first.  That
+    // costs nothing, but the table only holds 2^-21 ms, so a result
+    // within a hundredth of a us of a half can round the wrong way.
+    int shift=HUNSHIFT-10-whole;
+    if(shift < 1)
+        return 0xFFFFFFFFUL;   // far beyond MAXUS; clipped anyway
+    if(shift > 32)
+        return 0;
+
+    unsigned long m=pgm_read_dword(&HUNTAB[frac]);
+    unsigned long v=(m >> 10)*1000+(((m & 1023)*1000) >> 10);
+    return ((v >> (shift-1))+1) >> 1;
 }
 
 int Program::slotAddr(int slot)
@@ -361,8 +742,15 @@ void Program::save(int slot)
     
     int addr=slotAddr(slot);
     for(int i=0;i<MAXSTEPS;++i){
-        EEPROM.write(addr++, (steps[i].stops >> 8) & 0xFF);
-        EEPROM.write(addr++, steps[i].stops & 0xFF);
+        int word=steps[i].stops & ((1 << STOPSBITS)-1);
+        if(steps[i].parent != 0)
+            word|=steps[i].parent << STOPSBITS;
+        else if(steps[i].corner)
+            word|=(unsigned int)CORNERNIB << STOPSBITS;
+        else if(steps[i].stops < 0)
+            word|=0xF << STOPSBITS;
+        EEPROM.write(addr++, (word >> 8) & 0xFF);
+        EEPROM.write(addr++, word & 0xFF);
         EEPROM.write(addr++, steps[i].grade & 0xFF);
         for(int t=0;t<TEXTLEN;++t){
             EEPROM.write(addr++, steps[i].text[t]); 
@@ -380,6 +768,14 @@ bool Program::load(int slot)
     for(int i=0;i<MAXSTEPS;++i){
         tmp=EEPROM.read(addr++) << 8;
         tmp|=EEPROM.read(addr++);
+
+        // top nibble is the parent, unless it's just sign extension
+        unsigned char nib=(tmp >> STOPSBITS) & 0xF;
+        steps[i].parent=(nib < MAXSTEPS) ? nib : 0;
+        steps[i].corner=(nib == CORNERNIB);
+        tmp&=(1 << STOPSBITS)-1;
+        if(tmp & (1 << (STOPSBITS-1)))
+            tmp-=1 << STOPSBITS;
         steps[i].stops=tmp;
         steps[i].grade=EEPROM.read(addr++);
         for(int t=0;t<TEXTLEN;++t){
@@ -24,6 +24,9 @@
 #include <EEPROM.h>
 #include "Paper.h"
 #include "LEDDriver.h"
+#include "LampModel.h"
+#include "ZoneBalance.h"
+#include "EEPROMLayout.h"
 
 /**
  * Definition of a program of exposures
@@ -33,7 +36,7 @@ class Program {
   static const int SLOTBITS=7; // Allocates 128 bytes per slot
   static const int SLOTBASE=0x80;
   static const int TEXTLEN=18;
-  static const long MAXMS=999999L;    // ceiling of 1000s
+  static const long MAXUS=999999000L;    // ceiling of 1000s
 
 public:
 
@@ -41,6 +44,11 @@ public:
   static const int MAXEXPOSURES=MAXSTEPS * 2;
   static const int FIRSTSLOT=1;
   static const int LASTSLOT=7;
+  static_assert(SLOTBASE+((LASTSLOT-FIRSTSLOT) << SLOTBITS)+MAXSTEPS*(3+TEXTLEN) == EE_SLOTTOP,
+                "EE_SLOTTOP must be the end of the last program slot");
+  static_assert(EE_SLOTTOP <= EE_LAMPCOMP, "program slots overrun EE_LAMPCOMP");
+  /// grade rows in a two-dimensional test strip
+  static const int MAXROWS=4;
 
   /// a single exposure step
   class Step {
@@ -55,6 +63,8 @@ public:
 
       int stops;               // fixed-point, 1/100ths of a stop
       unsigned char grade;     // grade, ISO Exposure Scale
+      unsigned char parent;    // step this one lies inside; 0 = base (not nested)
+      bool corner;             // corner zone only, during the base exposure (normal mode)
       char text[TEXTLEN+1];    // description (only TEXTLEN(18) bytes written to EEPROM)
   };
 
@@ -66,12 +76,21 @@ public:
 	  /// rended only the time line (bottom row);
 	  void displayTime(LiquidCrystal &disp, char *buf, bool lin);
 	  void displayGrade(LiquidCrystal &disp, char *buf, bool lin);
-	  unsigned long ms;        // milliseconds to expose (post-compilation, not saved)
-	  unsigned char hardpower; //power for hard step, 0 is full, 255 is off
-	  unsigned char softpower; //power for soft step, 0 is full, 255 is off
+	  unsigned long us;        // microseconds to expose (post-compilation, not saved)
+	  unsigned long cornerus;  // as us for the corner zone, which may end earlier or later
+	  unsigned int hardpower;  //fine power for hard step (LEDDriver), 0 is full, FINE_OFF is off
+	  unsigned int softpower;  //fine power for soft step (LEDDriver), 0 is full, FINE_OFF is off
+	  unsigned int hardcorner; //as hardpower/softpower for the corner zone; the above
+	  unsigned int softcorner; //are the centre zone's once compiled (ZoneBalance)
+	  int stops;               // as step->stops, except in staggered strips
+	  unsigned char grade;     // as step->grade, except in grade strips
 	  Step* step; 
+	  Step* hold;              // nested mode: first area to start holding back, or NULL
+	  unsigned char holdsteps; // nested mode: every area to start holding back, bit per step
   };
 
+  Program();
+
   /// clear all entries, leaving base exposure of 0 stops
   void clear();
   void clearExposures();
@@ -83,8 +102,18 @@ public:
   /// determine number of valid exposure objects; first = base
   // unsigned char getCount();
 
-  /// convert a program from stops to linear time so that it can be execed
-  bool compile(char dd, bool sg, Paper& p);
+  /// true if any step declares a parent, which selects the nested compiler
+  bool isNested() const;
+
+  /// convert a program from stops to linear time so that it can be execed;
+  /// free if nothing changed since last time, and only exposures derived
+  /// from edited steps are redone if the settings are the same
+  /// @param fit seconds to fit dodge/burn exposures to by rescaling
+  ///        their LED power, the rest being made as short as possible;
+  ///        0 keeps the paper's powers.  Only for linearised LEDs.
+  /// @param lamp switching-edge offsets to compensate each exposure for
+  /// @param zb centre/corner balance to drive the zones with
+  bool compile(char dd, bool sg, unsigned char fit, Paper& p, const LampModel& lamp, const ZoneBalance& zb);
 
   /// save to EEPROM
   /// @param slot slot-number in 1..7
@@ -94,23 +123,89 @@ public:
   /// @param slot slot-number in 1..7
   bool load(int slot);
 
-  /// configure the program as a test strip;
+  /// configure the program as a test strip of one or more grade rows;
+  /// row r is at grade+r*gradestep (within the paper's range) and each
+  /// row is exposed in turn as an ordinary strip along the stops axis.
+  /// Staggered rows are offset by step/rows so that between them they
+  /// sample stops more finely.
   /// is assumed to compile after this.
-  void configureStrip(int base, int step, bool cover, unsigned char grade, Paper& p);
+  void configureStrip(int base, int step, bool cover, unsigned char grade,
+                      unsigned char rows, int gradestep, bool stagger, Paper& p);
 
 private:
 
-  int slotAddr(int slot);
-  void compileStripIndiv(char dd, Paper& p);
-  void compileStripCover(char dd, Paper& p);
-  bool compileNormal(char dd, bool sg, Paper& p);
-  void clipExposures();
+  static const unsigned char ALLSTEPS=(1 << MAXSTEPS)-1;
 
-  /// convert hundredths-of-stops to milliseconds
-  static unsigned long hunToMillis(int hunst);
+  /// what exposures[] were last compiled from
+  class CompileKey {
+    public:
+      bool valid;
+      bool isstrip, cover, splitgrade, nested;
+      unsigned char striprows, fit;
+      char dryval;
+      const Paper *paper;
+      unsigned int papergen, lampgen, balancegen;
+      int stops[MAXSTEPS];
+      unsigned char grade[MAXSTEPS];
+      unsigned char parent[MAXSTEPS];
+      bool corner[MAXSTEPS];
+  };
+
+  int slotAddr(int slot);
+  /// bitmask of steps whose stops/grade differ from the cache key
+  unsigned char changedSteps() const;
+  /// strip exposure for column c of grade row r
+  void compileStrip(unsigned char r, int c, char dd, Paper& p);
+  /// dodge/burn step i against baseus; records dodgeus[i], or
+  /// cornerus[i] for a corner step, which has no exposure of its own
+  void compileNormalStep(int i, char dd, bool sg, Paper& p);
+  /// base exposure(s) from baseus less total dodge time, with the
+  /// corner zone's time changed by the corner steps
+  bool compileNormalBase(bool sg, Paper& p);
+  /// steps with parents: expose in order of target level, see Program.cpp
+  bool compileNested(char dd, bool sg, Paper& p);
+  /// fill exposure j (and j+1 if split grade) for us of step st's grade,
+  /// cornerus of it in the corner zone
+  void setExposure(int j, unsigned long us, unsigned long cornerus, Step *st, bool sg, Paper& p);
+  /// clip and compensate one exposure for its lamp's per-cycle offset
+  /// @param fitus time to rescale its power for (fitPower()), or 0
+  void finishExposure(int which, const LampModel& lamp, const ZoneBalance& zb, unsigned long fitus);
+  /// change an exposure's power, and its times to match, so that it
+  /// takes as near fitus as the LEDs' range allows
+  static void fitPower(Exposure &e, unsigned long fitus);
+  /// fitting: what "as short as possible" still leaves for the lamp
+  /// offsets to be small against
+  static const long FITMINUS=1000000L;
+  /// one zone's time: stretched (ZoneBalance::apply()), clipped and
+  /// less the per-cycle offset, all in us
+  static unsigned long finishTime(unsigned long us, unsigned int stretch, long offset);
+
+  /// convert hundredths-of-stops to microseconds, integer-only; within
+  /// 1us of the exact value for every result that survives MAXUS
+  static unsigned long hunToMicros(int hunst);
+
+  /// binary point of the hunToMicros() mantissa table
+  static const int HUNSHIFT=21;
 
   // compilation settings
   bool isstrip, cover;
+  /// test strip geometry: rows of columns, each row's grade and stops offset
+  unsigned char striprows, stripcols;
+  unsigned char rowgrade[MAXROWS];
+  int rowoffset[MAXROWS];
+
+  // a stored stops word carries the parent in its top nibble; 0 or F
+  // there (plain sign extension) means not nested, as in old slots, and
+  // CORNERNIB marks a corner step (which older code reads as unnested)
+  static const int STOPSBITS=12;
+  static const unsigned char CORNERNIB=0x8;
+
+  CompileKey key;
+  /// normal mode: uncorrected base time and time taken by each dodge
+  unsigned long baseus;
+  unsigned long dodgeus[MAXSTEPS];
+  /// and the corner zone's time added (or taken) by each corner step
+  long cornerus[MAXSTEPS];
 
   /// first step is base, rest as dodges/burns
   Step steps[MAXSTEPS];
@@ -0,0 +1,108 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "RecordWriter.h"
+
+RecordWriter::RecordWriter(unsigned char n, bool b)
+{
+    fields=n;
+    binary=b;
+    len=0;
+}
+
+unsigned long RecordWriter::fileSize(const char *header, unsigned int records) const
+{
+    if(binary)
+        return 2UL*fields*records;
+    unsigned long size=(unsigned long)(FIELDWIDTH*fields+1)*records;
+    if(header)
+        size+=strlen(header)+2;
+    return size;
+}
+
+bool RecordWriter::open(const char *path, const char *header, unsigned int records)
+{
+    unsigned long size=fileSize(header, records);
+    len=0;
+
+    // not FILE_WRITE: that may append, and a file of the right size is
+    // overwritten where it lies rather than freed and allocated again
+    file=SD.open(path, O_READ | O_WRITE | O_CREAT);
+    if(file && file.size() != 0 && file.size() != size){
+        file.close();
+        SD.remove(path);
+        file=SD.open(path, O_READ | O_WRITE | O_CREAT);
+    }
+    if(!file || !file.seek(0))
+        return false;
+
+    if(header && !binary){
+        while(*header)
+            put(*header++);
+        put('\r');
+        put('\n');
+    }
+    return true;
+}
+
+void RecordWriter::write(const uint16_t *v)
+{
+    for(unsigned char i=0;i<fields;++i){
+        if(binary){
+            put(v[i] & 0xFF);
+            put(v[i] >> 8);
+            continue;
+        }
+        // right-aligned in five columns, as TextReader skips the spaces
+        char digits[5];
+        uint16_t x=v[i];
+        for(int d=4;d >= 0;--d){
+            digits[d]=(x || d == 4) ? '0'+x%10 : ' ';
+            x/=10;
+        }
+        for(unsigned char d=0;d<5;++d)
+            put(digits[d]);
+        if(i+1 < fields)
+            put(',');
+    }
+    if(!binary){
+        put('\r');
+        put('\n');
+    }
+}
+
+void RecordWriter::put(char c)
+{
+    buf[len++]=c;
+    if(len == BLOCK)
+        flush();
+}
+
+void RecordWriter::flush()
+{
+    if(len)
+        file.write(buf, len);
+    len=0;
+}
+
+void RecordWriter::close()
+{
+    flush();
+    file.close();
+}
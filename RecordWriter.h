@@ -0,0 +1,76 @@
+/* -*- C++ -*- */
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _RECORD_WRITER_H_
+#define _RECORD_WRITER_H_
+
+#include <Arduino.h>
+#include <SD.h>
+
+/**
+ * Buffered writer of fixed-size records of 16-bit fields, the
+ * counterpart of TextReader.
+ *
+ * Records are formatted into a BLOCK-byte buffer that goes to the card
+ * one whole sector at a time, instead of a library call per field.
+ * In CSV mode every field is padded to the same width, so a file's
+ * size is known before it is written; open() reuses an existing file
+ * of exactly that size in place, keeping its clusters, and only
+ * otherwise creates it afresh.  Binary mode writes each field as two
+ * bytes, LSB first, with no header.
+ */
+class RecordWriter {
+public:
+
+    /// @param fields per record
+    RecordWriter(unsigned char fields, bool binary);
+
+    /// bytes the file will hold
+    /// @param header CSV heading line without its line ending, or NULL
+    /// @param records number of records
+    unsigned long fileSize(const char *header, unsigned int records) const;
+
+    /// open path for fileSize() bytes and write the header
+    /// @return false if the card refused
+    bool open(const char *path, const char *header, unsigned int records);
+
+    /// append a record of the number of fields given to the constructor
+    void write(const uint16_t *v);
+
+    /// flush what is buffered and close the file
+    void close();
+
+private:
+
+    static const unsigned int BLOCK=512;
+    /// "65535," - every CSV field but the last is followed by a comma,
+    /// the last by \r\n
+    static const unsigned char FIELDWIDTH=6;
+
+    void put(char c);
+    void flush();
+
+    File file;
+    unsigned char fields;
+    bool binary;
+    uint8_t buf[BLOCK];
+    unsigned int len;
+};
+
+#endif // _RECORD_WRITER_H_
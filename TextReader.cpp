@@ -0,0 +1,113 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "TextReader.h"
+
+TextReader::TextReader(File &f)
+    : file(f)
+{
+    len=pos=0;
+}
+
+bool TextReader::fill()
+{
+    int n=file.read(buf, BUFLEN);
+    len=n > 0 ? n : 0;
+    pos=0;
+    return len > 0;
+}
+
+int TextReader::peek()
+{
+    if(pos == len && !fill())
+        return -1;
+    return (unsigned char)buf[pos];
+}
+
+int TextReader::get()
+{
+    int c=peek();
+    if(c >= 0)
+        ++pos;
+    return c;
+}
+
+bool TextReader::atEol()
+{
+    int c=peek();
+    return c < 0 || c == '\n' || c == '\r';
+}
+
+bool TextReader::atEnd()
+{
+    return peek() < 0;
+}
+
+bool TextReader::readInt(int &v)
+{
+    v=0;
+    while(peek() == ' ' || peek() == '\t')
+        get();
+    if(atEol())
+        return false;
+
+    bool neg=false;
+    if(peek() == '-' || peek() == '+')
+        neg=(get() == '-');
+    while(peek() >= '0' && peek() <= '9')
+        v=v*10+(get()-'0');
+    if(neg)
+        v=-v;
+
+    // anything else up to the delimiter is ignored, as toInt() did
+    while(!atEol()){
+        if(get() == ',')
+            break;
+    }
+    return true;
+}
+
+void TextReader::nextLine()
+{
+    int c;
+    do{
+        c=get();
+    } while(c >= 0 && c != '\n');
+}
+
+bool TextReader::readText(char *dst, int dlen)
+{
+    if(atEnd()){
+        dst[0]='\0';
+        return false;
+    }
+
+    while(peek() == ' ' || peek() == '\t')
+        get();
+    int n=0;
+    while(!atEol()){
+        char c=get();
+        if(n < dlen-1)
+            dst[n++]=c;
+    }
+    while(n > 0 && (dst[n-1] == ' ' || dst[n-1] == '\t'))
+        --n;
+    dst[n]='\0';
+    nextLine();
+    return true;
+}
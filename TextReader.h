@@ -0,0 +1,70 @@
+/* -*- C++ -*- */
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _TEXT_READER_H_
+#define _TEXT_READER_H_
+
+#include <Arduino.h>
+#include <SD.h>
+
+/**
+ * Streaming reader for comma-separated text files on the card.
+ *
+ * The file is pulled in BUFLEN-byte blocks and fields are decoded
+ * straight out of the block, so nothing is allocated and a line may be
+ * any length.  Fields are read left to right; a line is finished with
+ * nextLine() or by readText(), which takes the rest of it.  Both \n and
+ * \r\n line endings are accepted.
+ */
+class TextReader {
+public:
+
+    TextReader(File &f);
+
+    /// next integer field on this line; the following comma is consumed
+    /// @return false (v=0) if the line has no more fields
+    bool readInt(int &v);
+
+    /// rest of this line, trimmed, then move to the next line
+    /// @param len size of dst; longer text is truncated
+    /// @return false at end of file
+    bool readText(char *dst, int len);
+
+    /// skip whatever is left of this line
+    void nextLine();
+
+    /// no more input
+    bool atEnd();
+
+private:
+
+    static const unsigned char BUFLEN=32;
+
+    int peek();
+    int get();
+    bool fill();
+    /// at \r, \n or end of file
+    bool atEol();
+
+    File &file;
+    char buf[BUFLEN];
+    unsigned char len, pos;
+};
+
+#endif // _TEXT_READER_H_
@@ -0,0 +1,158 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "ZoneBalance.h"
+
+ZoneBalance::ZoneBalance()
+{
+    generation=0;
+    clear();
+}
+
+void ZoneBalance::clear()
+{
+    for(unsigned char t=0;t<2;++t){
+        gain[t][0]=gain[t][1]=UNITY;
+        centred[t]=cornered[t]=false;
+    }
+    valid=false;
+    ++generation;
+}
+
+void ZoneBalance::load()
+{
+    clear();
+    int addr=EE_BALANCE;
+    if(EEPROM.read(addr++) != MAGIC)
+        return;
+
+    for(unsigned char t=0;t<2;++t){
+        for(unsigned char z=0;z<2;++z){
+            unsigned int tmp=EEPROM.read(addr++) << 8;
+            tmp|=EEPROM.read(addr++);
+            gain[t][z]=tmp;
+        }
+    }
+    valid=true;
+}
+
+void ZoneBalance::save()
+{
+    int addr=EE_BALANCE;
+    EEPROM.write(addr++, MAGIC);
+    for(unsigned char t=0;t<2;++t){
+        for(unsigned char z=0;z<2;++z){
+            EEPROM.write(addr++, (gain[t][z] >> 8) & 0xFF);
+            EEPROM.write(addr++, gain[t][z] & 0xFF);
+        }
+    }
+    valid=true;
+}
+
+void ZoneBalance::setCentre(bool hard, unsigned long centrezone, unsigned long cornerzone)
+{
+    unsigned char t=hard ? 1 : 0;
+    centre[t][0]=centrezone;
+    centre[t][1]=cornerzone;
+    centred[t]=true;
+    cornered[t]=false;
+}
+
+bool ZoneBalance::setCorner(bool hard, unsigned long centrezone, unsigned long cornerzone)
+{
+    unsigned char t=hard ? 1 : 0;
+    if(!centred[t])
+        return false;
+    centred[t]=false;
+    cornered[t]=false;
+
+    // light at a spot is cc*rc + ck*rk for zone outputs rc, rk; even
+    // means the same at the corner as at the centre:
+    //   rc/rk = (corner's own gain) / (centre's own gain)
+    // and scaling both to keep the centre where it was gives the gains
+    float cc=centre[t][0], ck=centre[t][1];
+    float kc=centrezone, kk=cornerzone;
+    float own=kk-ck, centreown=cc-kc;
+    if(own <= 0 || centreown <= 0)
+        return false;
+    float q=own/centreown;
+    float gk=(cc+ck)/(cc*q+ck);
+    float gc=q*gk;
+    if(gc*UNITY < GAIN_MIN || gc*UNITY > GAIN_MAX
+       || gk*UNITY < GAIN_MIN || gk*UNITY > GAIN_MAX)
+        return false;
+
+    pending[t][0]=lrint(gc*UNITY);
+    pending[t][1]=lrint(gk*UNITY);
+    cornered[t]=true;
+
+    // both types or neither, so exposures never mix old and new
+    if(cornered[0] && cornered[1]){
+        for(unsigned char u=0;u<2;++u){
+            gain[u][0]=pending[u][0];
+            gain[u][1]=pending[u][1];
+            cornered[u]=false;
+        }
+        ++generation;
+        save();
+    }
+    return true;
+}
+
+unsigned int ZoneBalance::apply(unsigned int &centrehard, unsigned int &centresoft,
+                                unsigned int &cornerhard, unsigned int &cornersoft) const
+{
+    cornerhard=centrehard;
+    cornersoft=centresoft;
+    if(!valid)
+        return UNITY;
+
+    // outputs wanted, in 1/1024ths of full: [soft, hard][centre, corner]
+    unsigned long out[2][2];
+    unsigned long peak=0;
+    for(unsigned char t=0;t<2;++t){
+        unsigned long rel=LEDDriver::relativeOutput(t, t ? centrehard : centresoft);
+        for(unsigned char z=0;z<2;++z){
+            out[t][z]=(rel*gain[t][z]+UNITY/2)/UNITY;
+            // a lit channel stays lit
+            if(rel && !out[t][z])
+                out[t][z]=1;
+            peak=max(peak, out[t][z]);
+        }
+    }
+
+    // past full power: everything down in proportion, for longer
+    unsigned int stretch=UNITY;
+    if(peak > 1024){
+        stretch=(peak*UNITY+512)/1024;
+        for(unsigned char t=0;t<2;++t)
+            for(unsigned char z=0;z<2;++z)
+                out[t][z]=max(1UL, (out[t][z]*1024+peak/2)/peak);
+    }
+
+    if(centrehard != LEDDriver::FINE_OFF){
+        centrehard=LEDDriver::relativePower(true, out[1][0]);
+        cornerhard=LEDDriver::relativePower(true, out[1][1]);
+    }
+    if(centresoft != LEDDriver::FINE_OFF){
+        centresoft=LEDDriver::relativePower(false, out[0][0]);
+        cornersoft=LEDDriver::relativePower(false, out[0][1]);
+    }
+    return stretch;
+}
@@ -0,0 +1,116 @@
+/* -*- C++ -*- */
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _ZONE_BALANCE_H_
+#define _ZONE_BALANCE_H_
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "EEPROMLayout.h"
+#include "LEDDriver.h"
+
+/**
+ * Centre/corner balance of the two LED zones, so that the baseboard is
+ * lit evenly instead of falling off towards the edges.
+ *
+ * For each LED type the sensor reads each zone alone at full power,
+ * first with the sensor at the centre of the baseboard and then at a
+ * corner.  With linear LEDs the light anywhere is a fixed mix of the
+ * two zones' outputs, so one pair of gains per type evens out every
+ * grade: the zone that reaches the corner less is driven harder,
+ * relative to the other, and both are chosen so the centre gets what
+ * it got before.  Paper profiles and test strips made without the
+ * balance therefore still print the same at the centre.
+ *
+ * Where a gain would need more than full power the whole exposure is
+ * dimmed and lengthened instead; see apply().  Applied by
+ * Program::compile(), persisted at EE_BALANCE.
+ */
+class ZoneBalance {
+public:
+
+    /// gains are in 1/UNITY
+    static const unsigned int UNITY=1024;
+
+    ZoneBalance();
+
+    /// no balance: both zones as commanded
+    void clear();
+
+    /// read gains from EEPROM; cleared if never calibrated
+    void load();
+
+    bool isValid() const {
+        return valid;
+    }
+
+    /// changes whenever the gains do
+    unsigned int getGeneration() const {
+        return generation;
+    }
+
+    /// first half of a calibration: readings with the sensor at the
+    /// centre, each zone alone at full power
+    void setCentre(bool hard, unsigned long centrezone, unsigned long cornerzone);
+
+    /// setCentre() has been done for both types since the last clear(),
+    /// load() or setCorner()
+    bool hasCentre() const {
+        return centred[0] && centred[1];
+    }
+
+    /// second half: the same readings at a corner; computes the gains
+    /// for that type, and uses and saves them once both types are done
+    /// @return false (nothing changed) if the readings make no sense,
+    ///         e.g. the corner zone is no brighter at the corner
+    bool setCorner(bool hard, unsigned long centrezone, unsigned long cornerzone);
+
+    /// gain of one zone of one type
+    unsigned int getGain(bool hard, bool corner) const {
+        return gain[hard ? 1 : 0][corner ? 1 : 0];
+    }
+
+    /// balance one exposure: centre powers in, all four powers out
+    /// @return factor in 1/UNITY by which to lengthen the exposure,
+    ///         UNITY unless a zone would have gone past full power
+    unsigned int apply(unsigned int &centrehard, unsigned int &centresoft,
+                       unsigned int &cornerhard, unsigned int &cornersoft) const;
+
+private:
+
+    static const unsigned char MAGIC=0xB7;
+    /// gains outside 1/4 to 4 mean the sensor was misplaced
+    static const unsigned int GAIN_MIN=UNITY/4, GAIN_MAX=UNITY*4;
+
+    void save();
+
+    bool valid;
+    unsigned int generation;
+    /// [soft, hard][centre, corner]
+    unsigned int gain[2][2];
+
+    /// centre-position readings awaiting the corner ones, and gains
+    /// awaiting the other type's
+    bool centred[2];
+    unsigned long centre[2][2];
+    bool cornered[2];
+    unsigned int pending[2][2];
+};
+
+#endif // _ZONE_BALANCE_H_
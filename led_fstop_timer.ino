@@ -48,6 +48,8 @@
 #define EXPOSE_CORNER_HARD 10
 #define EXPOSE_CORNER_SOFT 9
 #define SAFELIGHT_RELAY 8
+// 14-bit LED PWM; needs all four exposure pins on Timer1/3 (e.g. 12, 11, 5, 2)
+#define HIRES_PWM false
 
 
 #define EXPOSEBTN 14  // low=depressed (internal pullup); not currently in use
@@ -127,7 +129,7 @@ void setup()
    Serial.begin(9600);
 
    disp.begin(20, 4);
-   leddriver.begin();
+   leddriver.begin(HIRES_PWM);
    keys.begin();
    rotary.begin();
    fst.begin();
@@ -0,0 +1,116 @@
+/*
+ * Just enough of the Arduino core to build the sketch's pure logic on a
+ * host compiler.  Registers are plain variables; nothing here drives
+ * hardware.
+ */
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+
+#define _BV(b) (1 << (b))
+#define cli()
+#define sei()
+#define ISR(v) extern "C" void v()
+
+#define constrain(a, lo, hi) ((a) < (lo) ? (lo) : ((a) > (hi) ? (hi) : (a)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+// every pin is on a timer of its own number; the port is SREG
+#define NOT_ON_TIMER 0
+#define digitalPinToTimer(p) (p)
+#define digitalPinToPort(p) (p)
+#define digitalPinToBitMask(p) (p)
+#define portOutputRegister(p) (&SREG)
+
+enum { TIMER0A = 1, TIMER0B, TIMER1A, TIMER1B, TIMER1C, TIMER2, TIMER2A, TIMER2B,
+       TIMER3A, TIMER3B, TIMER3C, TIMER4A, TIMER4B, TIMER4C, TIMER4D,
+       TIMER5A, TIMER5B, TIMER5C };
+
+#define HOST_REGS8(X) X(SREG) X(GTCCR) X(TCCR1A) X(TCCR1B) X(TCCR2A) X(TCCR2B) \
+    X(TCCR3A) X(TCCR3B) X(TCCR4A) X(TCCR4B) X(TCCR5A) X(TCCR5B) X(TIMSK5) \
+    X(TIFR5) X(OCR2A) X(OCR2B) X(TCNT2)
+#define HOST_REGS16(X) X(TCNT1) X(TCNT3) X(TCNT4) X(TCNT5) X(ICR1) X(ICR3) \
+    X(ICR4) X(OCR1A) X(OCR1B) X(OCR1C) X(OCR3A) X(OCR3B) X(OCR3C) X(OCR4A) \
+    X(OCR4B) X(OCR4C) X(OCR5A) X(OCR5B)
+#define HOST_DECLARE8(r) extern volatile uint8_t r;
+#define HOST_DECLARE16(r) extern volatile uint16_t r;
+HOST_REGS8(HOST_DECLARE8)
+HOST_REGS16(HOST_DECLARE16)
+
+enum { TSM = 7, PSRASY = 1, PSRSYNC = 0 };
+enum { WGM10 = 0, WGM11 = 1, WGM12 = 3, WGM13 = 4, CS10 = 0, CS11 = 1 };
+enum { WGM31 = 1, WGM33 = 4, CS30 = 0, WGM41 = 1, WGM43 = 4, CS40 = 0 };
+enum { WGM52 = 3, CS51 = 1, OCIE5A = 1, OCIE5B = 2, OCF5A = 1, OCF5B = 2 };
+enum { COM1A1 = 7, COM1B1 = 5, COM1C1 = 3, COM2A1 = 7, COM2B1 = 5 };
+enum { COM3A1 = 7, COM3B1 = 5, COM3C1 = 3, COM4A1 = 7, COM4B1 = 5, COM4C1 = 3 };
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+void analogWrite(uint8_t pin, int val);
+unsigned long micros();
+unsigned long millis();
+
+char *dtostrf(double val, signed char width, unsigned char prec, char *buf);
+char *itoa(int val, char *buf, int radix);
+
+/// String allocations made so far, for comparing parsers
+extern long stringallocs;
+
+/// the parts of Arduino's String the sketch has used, counting allocations
+class String {
+public:
+    String(const char *c = "") : s(c) { ++stringallocs; }
+    String(const String &o) : s(o.s) { ++stringallocs; }
+    String(int v) : s(std::to_string(v)) { ++stringallocs; }
+    String &operator=(const String &o) { s = o.s; ++stringallocs; return *this; }
+    String &operator+=(const char *c) { s += c; ++stringallocs; return *this; }
+    String &operator+=(int v) { s += std::to_string(v); ++stringallocs; return *this; }
+    String operator+(char c) const { String r(*this); r.s += c; return r; }
+    int indexOf(char c) const {
+        size_t p = s.find(c);
+        return p == std::string::npos ? -1 : (int)p;
+    }
+    String substring(int from, int to = -1) const {
+        String r;
+        r.s = s.substr(from, to < 0 ? std::string::npos : to - from);
+        return r;
+    }
+    void trim() {
+        size_t a = s.find_first_not_of(" \t\r\n");
+        size_t b = s.find_last_not_of(" \t\r\n");
+        s = a == std::string::npos ? "" : s.substr(a, b - a + 1);
+    }
+    long toInt() const { return atol(s.c_str()); }
+    void toCharArray(char *buf, int n) const {
+        strncpy(buf, s.c_str(), n - 1);
+        buf[n - 1] = 0;
+    }
+    unsigned int length() const { return s.size(); }
+    const char *c_str() const { return s.c_str(); }
+
+private:
+    std::string s;
+};
+
+#endif
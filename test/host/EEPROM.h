@@ -0,0 +1,19 @@
+#ifndef _HOST_EEPROM_H_
+#define _HOST_EEPROM_H_
+
+#include <Arduino.h>
+
+/// 4K of erased EEPROM
+class EEPROMClass {
+public:
+    EEPROMClass() { memset(mem, 0xFF, sizeof(mem)); }
+    uint8_t read(int addr) { return mem[addr]; }
+    void write(int addr, uint8_t val) { mem[addr] = val; }
+
+private:
+    uint8_t mem[4096];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
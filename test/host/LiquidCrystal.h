@@ -0,0 +1,17 @@
+#ifndef _HOST_LIQUIDCRYSTAL_H_
+#define _HOST_LIQUIDCRYSTAL_H_
+
+#include <Arduino.h>
+
+/// a display that shows nothing
+class LiquidCrystal {
+public:
+    LiquidCrystal(uint8_t data, uint8_t clk, uint8_t latch) {}
+    void begin(uint8_t cols, uint8_t rows) {}
+    void clear() {}
+    void setCursor(uint8_t col, uint8_t row) {}
+    template <class T> void print(T val) {}
+    void write(uint8_t c) {}
+};
+
+#endif
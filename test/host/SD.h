@@ -0,0 +1,59 @@
+#ifndef _HOST_SD_H_
+#define _HOST_SD_H_
+
+#include <Arduino.h>
+#include <map>
+
+#define FILE_READ 0x01
+#define FILE_WRITE 0x02
+
+/// one of SDClass's in-memory files; writes append
+class File {
+public:
+    File() : data(NULL), pos(0) {}
+    File(std::string *d) : data(d), pos(0) {}
+    operator bool() const { return data != NULL; }
+    int available() { return data ? data->size() - pos : 0; }
+    int read() { return available() ? (unsigned char)(*data)[pos++] : -1; }
+    int read(void *buf, uint16_t n) {
+        if (n > available())
+            n = available();
+        if (n)
+            memcpy(buf, data->data() + pos, n);
+        pos += n;
+        return n;
+    }
+    size_t write(const uint8_t *buf, size_t n) {
+        data->append((const char *)buf, n);
+        return n;
+    }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    uint32_t size() const { return data ? data->size() : 0; }
+    bool seek(uint32_t p) { pos = p; return data && p <= data->size(); }
+    void close() { data = NULL; }
+
+private:
+    std::string *data;
+    size_t pos;
+};
+
+/// a card holding whatever the test puts in files
+class SDClass {
+public:
+    std::map<std::string, std::string> files;
+    File open(const char *path, uint8_t mode = FILE_READ) {
+        std::map<std::string, std::string>::iterator f = files.find(path);
+        if (f == files.end()) {
+            if (!(mode & FILE_WRITE))
+                return File();
+            f = files.insert(std::make_pair(std::string(path), std::string())).first;
+        }
+        return File(&f->second);
+    }
+    bool exists(const char *path) { return files.count(path) != 0; }
+    bool remove(const char *path) { return files.erase(path) != 0; }
+};
+
+extern SDClass SD;
+
+#endif
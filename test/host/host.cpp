@@ -0,0 +1,44 @@
+/*
+ * Definitions behind the host stubs.  micros() is the host's clock, so
+ * tests can time themselves with it.
+ */
+#include <chrono>
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <SD.h>
+
+#define HOST_DEFINE(r) volatile decltype(r) r;
+HOST_REGS8(HOST_DEFINE)
+HOST_REGS16(HOST_DEFINE)
+
+EEPROMClass EEPROM;
+SDClass SD;
+long stringallocs = 0;
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t val) {}
+void analogWrite(uint8_t pin, int val) {}
+
+unsigned long micros()
+{
+    using namespace std::chrono;
+    static steady_clock::time_point t0 = steady_clock::now();
+    return duration_cast<microseconds>(steady_clock::now() - t0).count();
+}
+
+unsigned long millis()
+{
+    return micros() / 1000;
+}
+
+char *dtostrf(double val, signed char width, unsigned char prec, char *buf)
+{
+    sprintf(buf, "%*.*f", width, prec, val);
+    return buf;
+}
+
+char *itoa(int val, char *buf, int radix)
+{
+    sprintf(buf, radix == 16 ? "%x" : "%d", val);
+    return buf;
+}
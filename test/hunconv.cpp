@@ -0,0 +1,89 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/*
+ * Checks Program::hunToMicros() against a long double reference over
+ * every hundredth of a stop a compile can ask for, and times it against
+ * the float expression it replaced.  The timings are the host's; they
+ * say nothing about the AVR's soft float.
+ */
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LiquidCrystal.h>
+#include <SD.h>
+
+#define private public
+#include "Program.h"
+#undef private
+
+// sums of steps and offsets reach past the [-800, 999] the keypad allows
+static const int LOWEST=-2000;
+static const int HIGHEST=1500;
+static const int REPS=200;
+// Program::MAXUS, which comes before any access label
+static const long MAXUS=999999000L;
+
+static unsigned long floatMicros(int hunst)
+{
+    return lrintf(1000000.0f*powf(2.0f, 0.01f*hunst));
+}
+
+int main()
+{
+    int failures=0, inexact=0, floatoff=0, counted=0;
+    unsigned long last=0;
+    for(int h=LOWEST; h <= HIGHEST; ++h){
+        long double exact=1000000.0L*powl(2.0L, h/100.0L);
+        unsigned long us=Program::hunToMicros(h);
+        bool bad;
+        if(exact > MAXUS)
+            bad=us < (unsigned long)MAXUS;   // only needs to clip
+        else
+            bad=fabsl(us-exact) > 1.0L;
+        if(bad || us < last){
+            printf("FAIL h=%d: %lu, exact %.3Lf\n", h, us, exact);
+            ++failures;
+        }
+        last=us;
+        if(exact <= MAXUS){
+            unsigned long nearest=lrintl(exact);
+            ++counted;
+            inexact+=(us != nearest);
+            floatoff+=(floatMicros(h) != nearest);
+        }
+    }
+    printf("hunToMicros: %d to %d, %d of %d not nearest (float: %d)\n",
+           LOWEST, HIGHEST, inexact, counted, floatoff);
+
+    volatile unsigned long sink=0;
+    unsigned long t0=micros();
+    for(int r=0; r < REPS; ++r)
+        for(int h=LOWEST; h <= HIGHEST; ++h)
+            sink=sink+Program::hunToMicros(h);
+    unsigned long t1=micros();
+    for(int r=0; r < REPS; ++r)
+        for(int h=LOWEST; h <= HIGHEST; ++h)
+            sink=sink+floatMicros(h);
+    unsigned long t2=micros();
+    long calls=(long)REPS*(HIGHEST-LOWEST+1);
+    printf("hunToMicros on this host: %.1fns a call, float pow %.1fns\n",
+           1000.0*(t1-t0)/calls, 1000.0*(t2-t1)/calls);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/*
+ * Compiles nested dodge/burn programs and plays the exposures back over
+ * the innermost part of each step's area, holding back every area an
+ * exposure names from then on.  Each area must end up with exactly its
+ * own target time.
+ */
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LiquidCrystal.h>
+#include <SD.h>
+
+#define private public
+#include "Program.h"
+#undef private
+
+struct Case {
+    const char *name;
+    int steps;
+    int stops[Program::MAXSTEPS];
+    unsigned char parent[Program::MAXSTEPS];
+    unsigned char grade[Program::MAXSTEPS];
+};
+
+// areas that reach a level apart get grades of their own, so that each
+// exposure lights just the one area it names
+static const Case CASES[]={
+    { "burn in a burn, dodged", 4, { 200, 100, 100, -150 }, { 0, 0, 1, 2 },
+      { 100, 100, 100, 100 } },
+    { "sibling dodges", 4, { 100, -50, -50, -30 }, { 0, 0, 0, 0 },
+      { 100, 100, 100, 100 } },
+    { "burn in a dodge, dodged", 4, { 300, -100, 50, -120 }, { 0, 0, 1, 2 },
+      { 100, 100, 110, 100 } },
+    { "two burns, each dodged", 5, { 100, 100, 80, -40, -60 }, { 0, 0, 0, 1, 2 },
+      { 100, 120, 140, 100, 100 } },
+};
+
+/// whether exposure e reaches the innermost part of area s: the
+/// nearest area around it that is either held back or e's own decides
+static bool lit(const Program &p, int s, const Program::Exposure &e, unsigned char held)
+{
+    for(int a=s; ; a=p.steps[a].parent){
+        if(held & (1 << a))
+            return false;
+        if(&p.steps[a] == e.step)
+            return true;
+        if(a == 0)
+            return false;
+    }
+}
+
+static int check(const Case &c, Paper &paper)
+{
+    Program p;
+    p.clear();
+    for(int i=0; i < c.steps; ++i){
+        p.steps[i].stops=c.stops[i];
+        p.steps[i].grade=c.grade[i];
+        p.steps[i].parent=c.parent[i];
+    }
+    p.clearExposures();
+    if(!p.compileNested(0, false, paper)){
+        printf("FAIL %s: didn't compile\n", c.name);
+        return 1;
+    }
+
+    int failures=0;
+    for(int s=0; s < c.steps; ++s){
+        int total=0;
+        for(int a=s; ; a=c.parent[a]){
+            total+=c.stops[a];
+            if(a == 0)
+                break;
+        }
+
+        // a hold lasts from its exposure to the end
+        unsigned long got=0;
+        unsigned char held=0;
+        for(int j=0; j < Program::MAXEXPOSURES && p.exposures[j].us != 0; ++j){
+            held|=p.exposures[j].holdsteps;
+            if(lit(p, s, p.exposures[j], held))
+                got+=p.exposures[j].us;
+        }
+
+        unsigned long want=Program::hunToMicros(total);
+        if(got != want){
+            printf("FAIL %s: step %d got %luus, want %luus\n", c.name, s+1, got, want);
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+int main()
+{
+    Paper paper;
+    paper.init();
+
+    int failures=0;
+    for(unsigned int i=0; i < sizeof(CASES)/sizeof(CASES[0]); ++i)
+        failures+=check(CASES[i], paper);
+    printf("nested: %d programs, %d failures\n", (int)(sizeof(CASES)/sizeof(CASES[0])), failures);
+
+    return failures ? 1 : 0;
+}
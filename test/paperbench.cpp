@@ -0,0 +1,144 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/*
+ * Times Paper's TextReader parse of a .ppr against the String-based
+ * readLine()/parseLevel() parse it replaced, and checks that both read
+ * the same profile.
+ */
+
+#include <Arduino.h>
+#include <SD.h>
+
+#define private public
+#include "Paper.h"
+#undef private
+
+static const int LOADS=2000;
+static const int GRADES=35;
+
+/// the parse before TextReader, with its tables at 5-grade steps
+struct StringPaper {
+    String name;
+    unsigned char maxBrightnessSoft, maxBrightnessHard, minGrade, maxGrade;
+    unsigned char amountsSoft[GRADES], amountsHard[GRADES];
+
+    static unsigned char parseLevel(String level) {
+        level.trim();
+        return level.toInt();
+    }
+
+    static String readLine(File& dataFile) {
+        String ln = "";
+        while (dataFile.available()) {
+            char character = dataFile.read();
+            if (character == '\n') {
+                return ln;
+            }
+            else {
+                ln = ln + character;
+            }
+        }
+        return ln;
+    }
+
+    bool initFromFile(File& dataFile) {
+        if (dataFile.available()) {
+            name = readLine(dataFile);
+        }
+        String line;
+        line = readLine(dataFile);
+        int delim = line.indexOf(',');
+        maxBrightnessSoft = parseLevel(line.substring(0, delim));
+        maxBrightnessHard = parseLevel(line.substring(delim + 1));
+        minGrade = parseLevel(readLine(dataFile));
+        maxGrade = parseLevel(readLine(dataFile));
+        for (int pos = 0; pos < GRADES; pos++) {
+            line = readLine(dataFile);
+            int delim = line.indexOf(',');
+            amountsSoft[pos] = parseLevel(line.substring(0, delim));
+            amountsHard[pos] = parseLevel(line.substring(delim + 1));
+        }
+        return true;
+    }
+};
+
+/// a typical profile: soft falling and hard rising across the grades
+static std::string makePpr()
+{
+    std::string s = "Ilford MGIV RC Pearl\n217, 217\n55\n180\n";
+    char row[16];
+    for (int i = 0; i < GRADES; i++) {
+        int soft = i < 5 ? 255 : i < 30 ? 210 - 7 * (i - 5) : 9 - (i - 30);
+        int hard = i < 6 ? 0 : i < 30 ? 217 - soft : 255;
+        sprintf(row, "%d, %d\n", soft, hard);
+        s += row;
+    }
+    return s;
+}
+
+int main()
+{
+    SD.files["/papers/1.ppr"] = makePpr();
+
+    StringPaper before;
+    long allocs = stringallocs;
+    unsigned long t0 = micros();
+    for (int i = 0; i < LOADS; i++) {
+        File f = SD.open("/papers/1.ppr");
+        before.initFromFile(f);
+    }
+    unsigned long t1 = micros();
+    long beforeallocs = (stringallocs - allocs) / LOADS;
+
+    Paper after;
+    allocs = stringallocs;
+    unsigned long t2 = micros();
+    for (int i = 0; i < LOADS; i++) {
+        File f = SD.open("/papers/1.ppr");
+        after.initFromFile(f);
+    }
+    unsigned long t3 = micros();
+    long afterallocs = (stringallocs - allocs) / LOADS;
+
+    // the curve is thinned, so the tables need only agree to within the
+    // power unit setCurve() allows
+    int failures = 0;
+    if (strcmp(before.name.c_str(), after.getName()) != 0
+        || before.maxBrightnessSoft != after.maxBrightnessSoft
+        || before.maxBrightnessHard != after.maxBrightnessHard
+        || before.minGrade != after.minGrade || before.maxGrade != after.maxGrade) {
+        printf("FAIL: header differs\n");
+        ++failures;
+    }
+    for (int i = 0; i < GRADES; i++) {
+        unsigned char grade = 30 + 5 * i;
+        if (abs(before.amountsSoft[i] - after.getAmountSoft(grade)) > 1
+            || abs(before.amountsHard[i] - after.getAmountHard(grade)) > 1) {
+            printf("FAIL grade %d: %d,%d read as %d,%d\n", grade,
+                   before.amountsSoft[i], before.amountsHard[i],
+                   after.getAmountSoft(grade), after.getAmountHard(grade));
+            ++failures;
+        }
+    }
+
+    printf("paper load: String %.2fus, %ld allocations; TextReader %.2fus, %ld allocations\n",
+           (double)(t1 - t0) / LOADS, beforeallocs, (double)(t3 - t2) / LOADS, afterallocs);
+
+    return failures ? 1 : 0;
+}
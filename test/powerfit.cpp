@@ -0,0 +1,97 @@
+/*
+    Copyright (C) 2013 Larry Gebhardt
+    www.trippingthroughthedark.com
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+/*
+ * Fits exposures of various lengths to a power fit window with
+ * Program::fitPower() and checks that each lands on the window, or on
+ * the power limit that stops it, with its dose unchanged.  One has only
+ * its corner zone lit.
+ */
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <LiquidCrystal.h>
+#include <SD.h>
+
+#define private public
+#include "Program.h"
+#undef private
+
+struct Case {
+    unsigned long us;
+    unsigned char hard, soft;   // LEDDriver levels
+    unsigned long fitus;
+    bool corneronly;            // main zone dodged right out
+};
+
+static const Case CASES[]={
+    { 2000000UL, 150, LEDDriver::LED_OFF, 1000000UL },
+    { 4000000UL, 180, 190, 8000000UL },
+    { 4500000UL, 120, 150, 4000000UL },
+    { 15900000UL, 180, LEDDriver::LED_OFF, 8000000UL },
+    { 15900000UL, 170, 160, 12000000UL },
+    { 60000000UL, LEDDriver::LED_OFF, 190, 20000000UL },
+    { 300000000UL, 190, 195, 20000000UL },
+    { 15900000UL, 180, 170, 8000000UL, true },
+};
+
+/// light output in 1/1024ths of full power, as fitPower() scales it
+static unsigned int output(const Program::Exposure &e)
+{
+    return max(LEDDriver::relativeOutput(true, e.hardpower),
+               LEDDriver::relativeOutput(false, e.softpower));
+}
+
+/// a lit type within a hair of its dimmest stable level
+static bool dimmest(bool hard, unsigned int power)
+{
+    unsigned int rel=LEDDriver::relativeOutput(hard, power);
+    unsigned int least=LEDDriver::relativeOutput(hard,
+        LEDDriver::toFine(hard ? LEDDriver::LED_HARD_MIN : LEDDriver::LED_SOFT_MIN));
+    return rel != 0 && rel <= least+2;
+}
+
+int main()
+{
+    int failures=0;
+    for(unsigned int i=0; i < sizeof(CASES)/sizeof(CASES[0]); ++i){
+        const Case &c=CASES[i];
+        Program::Exposure e;
+        e.us=c.corneronly ? 0 : c.us;
+        e.cornerus=c.us;
+        e.hardpower=LEDDriver::toFine(c.hard);
+        e.softpower=LEDDriver::toFine(c.soft);
+        double dose=(double)c.us*output(e);
+
+        Program::fitPower(e, c.fitus);
+
+        // full power, or a lit type at its dimmest, is as far as it goes
+        double fitted=(double)e.cornerus*output(e);
+        double err=fitted/dose-1;
+        bool full=output(e) >= 1023;
+        bool dim=dimmest(true, e.hardpower) || dimmest(false, e.softpower);
+        bool bad=fabs(err) > 0.002 || e.us != (c.corneronly ? 0 : e.cornerus)
+            || (!full && !dim && fabs((double)e.cornerus/c.fitus-1) > 0.01);
+        printf("%s %.2fs into %.0fs: %.3fs at %u/1024%s, dose %+.3f%%\n",
+               bad ? "FAIL" : "ok", c.us*1e-6, c.fitus*1e-6, e.cornerus*1e-6,
+               output(e), full ? " (full)" : dim ? " (dimmest)" : "", 100*err);
+        failures+=bad;
+    }
+
+    return failures ? 1 : 0;
+}